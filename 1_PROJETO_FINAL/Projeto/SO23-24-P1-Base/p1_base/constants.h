@@ -1,2 +1,4 @@
 #define MAX_RESERVATION_SIZE 256
 #define STATE_ACCESS_DELAY_MS 10
+#define COMMAND_RING_SIZE 64  // Commands the parser may decode ahead of the executors
+#define STEAL_BATCH_SIZE 32   // Commands a worker decodes from a job file before the file goes back in its queue
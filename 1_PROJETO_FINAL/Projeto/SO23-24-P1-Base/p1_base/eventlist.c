@@ -33,8 +33,7 @@ int append_to_list(struct EventList* list, struct Event* event) {
 static void free_event(struct Event* event) {
   if (!event) return;
 
-  free(event->mutex_seats);
-  free(event->data);
+  free((void*)event->data);
   free(event);
 }
 
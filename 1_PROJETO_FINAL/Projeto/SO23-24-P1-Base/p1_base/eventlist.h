@@ -2,19 +2,19 @@
 #define EVENT_LIST_H
 
 #include <stddef.h>
-#include <pthread.h>
+#include <stdatomic.h>
+
+/// Marks a seat claimed by a reservation that has not committed yet. Readers treat it as free.
+#define SEAT_PENDING ((unsigned int)-1)
 
 struct Event {
-  unsigned int id;            /// Event id
-  unsigned int reservations;  /// Number of reservations for the event.
+  unsigned int id;           /// Event id
+  atomic_uint reservations;  /// Number of reservations for the event.
 
   size_t cols;  /// Number of columns.
   size_t rows;  /// Number of rows.
 
-  pthread_mutex_t* mutex_seats;
-
-  unsigned int* data;  /// Array of size rows * cols with the reservations for each seat.
-  
+  _Atomic unsigned int* data;  /// Array of size rows * cols with the reservations for each seat.
 };
 
 struct ListNode {
@@ -1,6 +1,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,157 +10,320 @@
 #include <string.h>
 #include <sys/wait.h>
 #include <pthread.h> 
+#include <stdatomic.h>
 
 #include "constants.h"
 #include "operations.h"
 #include "parser.h"
 
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+// One decoded command, fixed size so the ring holding them is allocated once
+struct CommandRecord {
+    enum Command cmd;
+    unsigned int event_id;
+    unsigned int delay;      // WAIT
+    unsigned int thread_id;  // Executor a WAIT is meant for
+    size_t num_rows;         // CREATE
+    size_t num_columns;      // CREATE
+    size_t num_coords;       // RESERVE, number of valid entries in xs and ys
+    size_t xs[MAX_RESERVATION_SIZE];
+    size_t ys[MAX_RESERVATION_SIZE];
+};
+
+// What the ring knows of an executor
+struct Executor {
+    unsigned int pending_wait;  // Delay owed before the next command, left by the executor that took the WAIT
+    int running;                // Whether it runs a command on event_id, or a LIST
+    unsigned int event_id;
+};
+
+// Commands the parser decoded and the executors have not taken yet
+struct CommandRing {
+    struct CommandRecord records[COMMAND_RING_SIZE];
+    unsigned char taken[COMMAND_RING_SIZE];  // Records taken ahead of an older one, freed once head passes them
+    size_t head;   // Index of the oldest record
+    size_t count;  // Number of records from head on, taken or not
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct Executor *executors;   // Indexed by thread id
+    unsigned int num_executors;
+    size_t num_running;           // Executors running a LIST or a command on an event
+    int fence_running;            // Whether the one running is a LIST, nothing else may start meanwhile
+    unsigned int creator;         // Executor running a CREATE, 0 if none, so events are listed in the order parsed
+    pthread_barrier_t phase;      // Executors meet here on every BARRIER, then go on with the next phase
+};
+
+static struct CommandRing ring = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+};
 
 // Structure to pass arguments to the thread function
 struct ThreadArgs {
-    int in_fd;
     int out_fd;
     int thread_id;
 };
 
-int barrierFlag = 0;
-
-// Function executed by each thread
-void *thread_function(void *args_void_ptr){
+/// Gets the free slot the next command is decoded into, waiting for the executors to make room.
+/// @note Only the parser calls it, the slot stays free until commit_record() hands it over.
+static struct CommandRecord *next_record(void) {
+    pthread_mutex_lock(&ring.lock);
+    while (ring.count == COMMAND_RING_SIZE) {
+        pthread_cond_wait(&ring.not_full, &ring.lock);
+    }
+    struct CommandRecord *record = &ring.records[(ring.head + ring.count) % COMMAND_RING_SIZE];
+    pthread_mutex_unlock(&ring.lock);
 
-    int wait_id = 0;
-    int wait_delay = 0;
-    int flag = 0;
-    struct ThreadArgs *args = (struct ThreadArgs *)args_void_ptr;
-    int in_fd = args->in_fd;
-    int out_fd = args->out_fd;
-    int counter = 0;
+    return record;
+}
 
-    while (flag == 0) {
-        unsigned int event_id, delay, thread_id;
-        size_t num_rows, num_columns, num_coords;
-        size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+/// Hands the record from next_record() to the executors.
+static void commit_record(void) {
+    pthread_mutex_lock(&ring.lock);
+    ring.count++;
+    pthread_cond_signal(&ring.not_empty);
+    pthread_mutex_unlock(&ring.lock);
+}
 
-        if(wait_id == args->thread_id){
+/// Checks whether a command on an event has to wait for an older one.
+/// @param event_id Event of the command.
+/// @param skipped Events of the older records not taken yet.
+/// @param num_skipped Number of entries in skipped.
+/// @return 1 if an older command on the event is running or waiting, 0 otherwise.
+static int event_busy(unsigned int event_id, const unsigned int *skipped, size_t num_skipped) {
+    for (size_t i = 0; i < num_skipped; i++) {
+        if (skipped[i] == event_id) {
+            return 1;
+        }
+    }
 
-          fprintf(stderr, "Waiting...\n");
-          ems_wait((unsigned int)wait_delay);
-          wait_id = 0;
-          wait_delay =0;
+    for (unsigned int i = 1; i <= ring.num_executors; i++) {
+        if (ring.executors[i].running && ring.executors[i].event_id == event_id) {
+            return 1;
         }
+    }
+    return 0;
+}
 
-        pthread_mutex_lock(&mutex);
+/// Finds the oldest record that may run now.
+/// @note Commands on one event run one at a time in the order they were parsed, those on different events run side
+/// by side. CREATEs also run one at a time in that order, since it is the order LIST shows. Targeted WAITs, LIST,
+/// BARRIER and the end of the file are fences: nothing after them is taken before they are, and they are only taken
+/// once everything before them was, a LIST also waiting for what is still running.
+/// @return Index of the record, COMMAND_RING_SIZE if none may run yet.
+static size_t find_record(void) {
+    unsigned int skipped[COMMAND_RING_SIZE];
+    size_t num_skipped = 0;
+    int oldest = 1;
+    int create_skipped = 0;
+
+    if (ring.fence_running) {
+        return COMMAND_RING_SIZE;
+    }
 
-        if(barrierFlag == 1){
-          pthread_mutex_unlock(&mutex);
-          free(args);
-          return NULL;
+    for (size_t i = 0; i < ring.count; i++) {
+        size_t index = (ring.head + i) % COMMAND_RING_SIZE;
+        if (ring.taken[index]) {
+            continue;
         }
 
-        switch (get_next(in_fd)) {
+        struct CommandRecord *record = &ring.records[index];
+        switch (record->cmd) {
           case CMD_CREATE:
-            counter++;
-            if (parse_create(in_fd, &event_id, &num_rows, &num_columns) != 0) {
+            if (!create_skipped && ring.creator == 0 && !event_busy(record->event_id, skipped, num_skipped)) {
+              return index;
+            }
+            skipped[num_skipped++] = record->event_id;
+            create_skipped = 1;
+            break;
 
-              pthread_mutex_unlock(&mutex);
-              fprintf(stderr, "Invalid command. See HELP for usage\n");
-              continue;
+          case CMD_RESERVE:
+          case CMD_SHOW:
+            if (!event_busy(record->event_id, skipped, num_skipped)) {
+              return index;
             }
+            skipped[num_skipped++] = record->event_id;
+            break;
 
-            pthread_mutex_unlock(&mutex);
-            if (ems_create(event_id, num_rows, num_columns)) {
+          case CMD_LIST_EVENTS:
+            return oldest && ring.num_running == 0 ? index : COMMAND_RING_SIZE;
 
-              fprintf(stderr, "Failed to create event\n");
-            }
+          case CMD_WAIT:
+          case CMD_BARRIER:
+          case EOC:
+            return oldest ? index : COMMAND_RING_SIZE;
+
+          case CMD_HELP:
+          case CMD_EMPTY:
+          case CMD_INVALID:
             break;
+        }
 
-          case CMD_RESERVE:
-          counter++;
-            num_coords = parse_reserve(in_fd, MAX_RESERVATION_SIZE, &event_id, xs, ys);
-            pthread_mutex_unlock(&mutex);
+        oldest = 0;
+    }
 
-            if (num_coords == 0) {
+    return COMMAND_RING_SIZE;
+}
 
-              fprintf(stderr, "Invalid command. See HELP for usage\n");
-              continue;
-            }
-            if (ems_reserve(event_id, num_coords, xs, ys)) {
+/// Takes the oldest command that may run off the ring, first serving the waits other executors left for the caller.
+/// @note The command the caller ran before is taken as finished, which may let others run.
+/// @param thread_id Id of the calling executor.
+/// @param record Where the command is copied to.
+static void take_record(int thread_id, struct CommandRecord *record) {
+    struct Executor *self = &ring.executors[thread_id];
+    size_t index;
+
+    pthread_mutex_lock(&ring.lock);
+
+    // Nothing starts while a LIST runs, so if one did it was this executor's
+    if (self->running) {
+        self->running = 0;
+        ring.num_running--;
+        ring.fence_running = 0;
+        if (ring.creator == (unsigned int)thread_id) {
+            ring.creator = 0;
+        }
+        pthread_cond_broadcast(&ring.not_empty);
+    }
 
-              fprintf(stderr, "Failed to reserve seats\n");
-            }
+    while (1) {
+        unsigned int delay = self->pending_wait;
+        if (delay > 0) {
+            self->pending_wait = 0;
+            pthread_mutex_unlock(&ring.lock);
 
+            fprintf(stderr, "Waiting...\n");
+            ems_wait(delay);
+
+            pthread_mutex_lock(&ring.lock);
+            continue;
+        }
+
+        index = find_record();
+        if (index != COMMAND_RING_SIZE) {
             break;
+        }
+        pthread_cond_wait(&ring.not_empty, &ring.lock);
+    }
 
-          case CMD_SHOW:
-          counter++;
-            if (parse_show(in_fd, &event_id) != 0) {
+    // Only the coordinates in use are copied, most commands have none
+    struct CommandRecord *slot = &ring.records[index];
+    memcpy(record, slot, offsetof(struct CommandRecord, xs));
+    if (slot->cmd == CMD_RESERVE) {
+        memcpy(record->xs, slot->xs, slot->num_coords * sizeof(size_t));
+        memcpy(record->ys, slot->ys, slot->num_coords * sizeof(size_t));
+    }
+    ring.taken[index] = 1;
+
+    if (slot->cmd == CMD_LIST_EVENTS) {
+        self->running = 1;
+        ring.num_running++;
+        ring.fence_running = 1;
+    } else if (slot->cmd == CMD_CREATE || slot->cmd == CMD_RESERVE || slot->cmd == CMD_SHOW) {
+        self->running = 1;
+        self->event_id = slot->event_id;
+        ring.num_running++;
+        if (slot->cmd == CMD_CREATE) {
+            ring.creator = (unsigned int)thread_id;
+        }
+    }
+
+    // Slots are only handed back to the parser in order
+    size_t freed = 0;
+    while (ring.count > 0 && ring.taken[ring.head]) {
+        ring.taken[ring.head] = 0;
+        ring.head = (ring.head + 1) % COMMAND_RING_SIZE;
+        ring.count--;
+        freed++;
+    }
+    if (freed > 0) {
+        pthread_cond_signal(&ring.not_full);
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
+
+/// Queues one marker per executor, each executor stops at the first it takes so every one of them takes exactly one.
+/// @param cmd CMD_BARRIER or EOC.
+/// @param num_executors Number of executors running.
+static void queue_markers(enum Command cmd, unsigned int num_executors) {
+    for (unsigned int i = 0; i < num_executors; i++) {
+        next_record()->cmd = cmd;
+        commit_record();
+    }
+}
+
+/// Decodes the next command that needs an executor.
+/// @note Commands that need no executor are handled here: errors and HELP are reported and a WAIT meant for no
+/// executor in particular holds the parser back, so nothing after it starts before the delay is over.
+/// @param jobs Job file to parse.
+/// @param record Where the command is decoded to.
+/// @param num_executors Number of executors, a WAIT for a higher thread id is meant for none of them.
+/// @return The command decoded, CMD_BARRIER or EOC.
+static enum Command decode_command(struct JobFile *jobs, struct CommandRecord *record, unsigned int num_executors) {
+    while (1) {
+        record->cmd = get_next(jobs);
+
+        switch (record->cmd) {
+          case CMD_CREATE:
+            if (parse_create(jobs, &record->event_id, &record->num_rows, &record->num_columns) != 0) {
 
-              pthread_mutex_unlock(&mutex);
               fprintf(stderr, "Invalid command. See HELP for usage\n");
               continue;
             }
+            break;
+
+          case CMD_RESERVE:
+            record->num_coords = parse_reserve(jobs, MAX_RESERVATION_SIZE, &record->event_id, record->xs, record->ys);
 
-            pthread_mutex_unlock(&mutex);
-            if (ems_show(out_fd, event_id)) {
+            if (record->num_coords == 0) {
 
-              fprintf(stderr, "Failed to show event\n");
+              fprintf(stderr, "Invalid command. See HELP for usage\n");
+              continue;
             }
             break;
 
-          case CMD_LIST_EVENTS:
-          counter++;
-            pthread_mutex_unlock(&mutex);
-            if (ems_list_events(out_fd)) {
+          case CMD_SHOW:
+            if (parse_show(jobs, &record->event_id) != 0) {
 
-              fprintf(stderr, "Failed to list events\n");
+              fprintf(stderr, "Invalid command. See HELP for usage\n");
+              continue;
             }
             break;
 
-          case CMD_WAIT:
-          counter++;
-            if (parse_wait(in_fd, &delay, &thread_id) == -1) {  
+          case CMD_LIST_EVENTS:
+            break;
+
+          case CMD_WAIT: {
+            int targeted = parse_wait(jobs, &record->delay, &record->thread_id);
+
+            if (targeted == -1) {
 
-              pthread_mutex_unlock(&mutex);
               fprintf(stderr, "Invalid command. See HELP for usage\n");
               continue;
             }
-            if (thread_id != 0){
-              if(args->thread_id == (int)thread_id){
+
+            if (targeted == 0 || record->thread_id == 0) {
+              if (record->delay > 0) {
 
                 fprintf(stderr, "Waiting...\n");
-                ems_wait(delay);
-                delay = 0;
-                thread_id = 0;
-              } else{
-
-                wait_id = (int)thread_id;
-                wait_delay = (int)delay;
-                delay = 0;
-                thread_id = 0;
+                ems_wait(record->delay);
               }
-
+              continue;
             }
 
-            pthread_mutex_unlock(&mutex);
-
-            if (delay > 0) {
-
-              pthread_mutex_lock(&mutex);
-              fprintf(stderr, "Waiting...\n");
-              ems_wait(delay);
-              pthread_mutex_unlock(&mutex);
+            // Queued as a marker, so the executor only waits once the commands before it were taken
+            if (record->thread_id > num_executors) {
+              continue;
             }
-
             break;
+          }
 
           case CMD_INVALID:
-            pthread_mutex_unlock(&mutex);
             fprintf(stderr, "Invalid command. See HELP for usage\n");
-            break;
+            continue;
 
           case CMD_HELP:
-            pthread_mutex_unlock(&mutex);
             fprintf(stderr,
                 "Available commands:\n"
                 "  CREATE <event_id> <num_rows> <num_columns>\n"
@@ -169,39 +333,569 @@ void *thread_function(void *args_void_ptr){
                 "  WAIT <delay_ms> [thread_id]\n"  
                 "  BARRIER\n"
                 "  HELP\n");
+            continue;
+
+          case CMD_EMPTY:
+            continue;
+
+          case CMD_BARRIER:
+          case EOC:
+            break;
+        }
+
+        return record->cmd;
+    }
+}
+
+/// Decodes the whole job file into the ring, ending it with an EOC marker for each executor.
+/// @param jobs Job file to parse.
+/// @param num_executors Number of executors.
+static void parse_jobs(struct JobFile *jobs, unsigned int num_executors) {
+    while (1) {
+        enum Command cmd = decode_command(jobs, next_record(), num_executors);
+
+        if (cmd == EOC) {
+            queue_markers(EOC, num_executors);
+            return;
+        }
+
+        if (cmd == CMD_BARRIER) {
+            // Nothing queued after the markers is taken before every executor reached the barrier
+            queue_markers(CMD_BARRIER, num_executors);
+        } else {
+            commit_record();
+        }
+    }
+}
+
+/// Runs a CREATE, RESERVE, SHOW or LIST.
+/// @param state State the command acts on, NULL for the default one.
+/// @param out_fd Where SHOW and LIST print to.
+/// @param record Command to run.
+static void run_command(struct EmsState *state, int out_fd, struct CommandRecord *record) {
+    switch (record->cmd) {
+      case CMD_CREATE:
+        if (ems_create(state, record->event_id, record->num_rows, record->num_columns)) {
+
+          fprintf(stderr, "Failed to create event\n");
+        }
+        break;
+
+      case CMD_RESERVE:
+        if (ems_reserve(state, record->event_id, record->num_coords, record->xs, record->ys)) {
 
+          fprintf(stderr, "Failed to reserve seats\n");
+        }
+        break;
+
+      case CMD_SHOW:
+        if (ems_show(state, out_fd, record->event_id)) {
+
+          fprintf(stderr, "Failed to show event\n");
+        }
+        break;
+
+      case CMD_LIST_EVENTS:
+        if (ems_list_events(state, out_fd)) {
+
+          fprintf(stderr, "Failed to list events\n");
+        }
+        break;
+
+      case CMD_WAIT:
+      case CMD_BARRIER:
+      case CMD_HELP:
+      case CMD_EMPTY:
+      case CMD_INVALID:
+      case EOC:
+        break;
+    }
+}
+
+
+// Function executed by each executor
+void *thread_function(void *args_void_ptr){
+
+    struct ThreadArgs *args = (struct ThreadArgs *)args_void_ptr;
+    int out_fd = args->out_fd;
+    int thread_id = args->thread_id;
+
+    struct CommandRecord record;
+
+    while (1) {
+        take_record(thread_id, &record);
+
+        switch (record.cmd) {
+          case CMD_CREATE:
+          case CMD_RESERVE:
+          case CMD_SHOW:
+          case CMD_LIST_EVENTS:
+            run_command(NULL, out_fd, &record);
             break;
 
-          case CMD_BARRIER: 
-          
-            barrierFlag = 1;
-            pthread_mutex_unlock(&mutex);
-            free(args);
-            pthread_exit((void *)1); // Signal that BARRIER command is encountered  //add
-            flag = 1;
-            printf("%s",counter);
-            
+          case CMD_WAIT:
+            if ((int)record.thread_id == thread_id) {
+
+              fprintf(stderr, "Waiting...\n");
+              ems_wait(record.delay);
+            } else {
+
+              pthread_mutex_lock(&ring.lock);
+              ring.executors[record.thread_id].pending_wait += record.delay;
+              pthread_mutex_unlock(&ring.lock);
+            }
             break;
-          case CMD_EMPTY:
-            pthread_mutex_unlock(&mutex);
+
+          case CMD_BARRIER:
+            pthread_barrier_wait(&ring.phase);
             break;
 
           case EOC:
-            pthread_mutex_unlock(&mutex);
-            free(args);
-            pthread_exit((void *)EOF);
-            flag = 1;
+            return NULL;
+
+          case CMD_HELP:
+          case CMD_EMPTY:
+          case CMD_INVALID:
             break;
         }
     }
+}
+
+// Work run by the shared workers when every job file is run in this process
+struct Task {
+    struct Task *next;
+    struct FileJob *job;
+    int parse;                    // Whether the task decodes the next batch of the file instead of running record
+    struct Task *next_in_file;    // Next command of the same file, in the order they were parsed
+    int queued;                   // Whether the command was handed to a worker, it stays in its file until it ran
+    struct CommandRecord record;
+};
+
+// Job file run in this process, with its own events so files never see each other's
+struct FileJob {
+    struct JobFile jobs;
+    int input_fd;
+    int output_fd;
+    struct EmsState *state;
+    pthread_mutex_t lock;   // Protects the fields below
+    struct Task *head;      // Commands parsed and not finished, oldest first, like the records of the ring
+    struct Task *tail;
+    size_t num_tasks;
+    size_t resume_below;    // Parsing stopped until fewer commands than this are left, 0 if it did not
+    int parsed;             // Whether parsing reached the end of the file
+    struct Task parse_task; // A file is parsed by a single task at a time, this one
+};
+
+// Tasks of one worker, the others steal from it when their own run out
+struct TaskQueue {
+    pthread_mutex_t lock;
+    struct Task *head;
+    struct Task *tail;
+};
+
+// Workers shared by every job file
+struct StealPool {
+    struct TaskQueue *queues;  // One per worker
+    unsigned int num_workers;
+    atomic_size_t queued;      // Tasks in every queue, counted before they are queued so it is never short
+    atomic_size_t idle;        // Workers sleeping until there is work
+    atomic_size_t remaining;   // Job files not finished
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+};
+
+static struct StealPool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+};
+
+/// Queues a task on a worker, waking a sleeping worker to steal it.
+/// @param worker Index of the worker, the one queueing it unless the pool is not running yet.
+/// @param task Task to queue.
+static void push_task(unsigned int worker, struct Task *task) {
+    struct TaskQueue *queue = &pool.queues[worker];
+    atomic_fetch_add(&pool.queued, 1);
+
+    task->next = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail != NULL) {
+        queue->tail->next = task;
+    } else {
+        queue->head = task;
+    }
+    queue->tail = task;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (atomic_load(&pool.idle) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_signal(&pool.work);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+/// Takes the oldest task of a queue.
+/// @return The task, NULL if the queue is empty.
+static struct Task *pop_task(struct TaskQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    struct Task *task = queue->head;
+    if (task != NULL) {
+        queue->head = task->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    if (task != NULL) {
+        atomic_fetch_sub(&pool.queued, 1);
+    }
+    return task;
+}
+
+/// Takes a task from the worker's own queue, or steals the oldest of another worker.
+/// @return The task, NULL if every queue is empty.
+static struct Task *find_task(unsigned int worker) {
+    for (unsigned int i = 0; i < pool.num_workers; i++) {
+        struct Task *task = pop_task(&pool.queues[(worker + i) % pool.num_workers]);
+        if (task != NULL) {
+            return task;
+        }
+    }
     return NULL;
 }
 
+/// Releases a job file whose commands all ran, stopping the workers after the last one.
+static void finish_job(struct FileJob *job) {
+    close_job_file(&job->jobs);
+    close(job->input_fd);
+    close(job->output_fd);
+    ems_state_destroy(job->state);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+
+    if (atomic_fetch_sub(&pool.remaining, 1) == 1) {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_broadcast(&pool.work);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+/// Hands the commands of a job file that may run now to the worker's queue.
+/// @note The order is the one find_record() keeps: commands on one event run one at a time in the order they were
+/// parsed, those on different events run side by side, CREATEs run one at a time in that order, and a LIST only runs
+/// once everything before it finished, nothing after it starting before it did.
+/// @note The lock of the file must be held.
+/// @param worker Index of the calling worker.
+/// @param job Job file whose commands are checked.
+static void queue_ready(unsigned int worker, struct FileJob *job) {
+    unsigned int older[COMMAND_RING_SIZE];  // Events of the commands before the one checked
+    size_t num_older = 0;
+    int older_create = 0;                   // Whether a CREATE before the one checked has not finished
+
+    for (struct Task *task = job->head; task != NULL; task = task->next_in_file) {
+        struct CommandRecord *record = &task->record;
+        int ready = 1;
+
+        switch (record->cmd) {
+          case CMD_CREATE:
+            ready = !older_create;
+            older_create = 1;
+            for (size_t i = 0; i < num_older && ready; i++) {
+              ready = older[i] != record->event_id;
+            }
+            older[num_older++] = record->event_id;
+            break;
+
+          case CMD_RESERVE:
+          case CMD_SHOW:
+            for (size_t i = 0; i < num_older && ready; i++) {
+              ready = older[i] != record->event_id;
+            }
+            older[num_older++] = record->event_id;
+            break;
+
+          case CMD_LIST_EVENTS:
+            if (task == job->head && !task->queued) {
+              task->queued = 1;
+              push_task(worker, task);
+            }
+            return;
+
+          case CMD_WAIT:
+          case CMD_BARRIER:
+          case CMD_HELP:
+          case CMD_EMPTY:
+          case CMD_INVALID:
+          case EOC:
+            break;
+        }
+
+        if (ready && !task->queued) {
+            task->queued = 1;
+            push_task(worker, task);
+        }
+    }
+}
+
+/// Decodes up to STEAL_BATCH_SIZE commands of a job file, queueing the ones that may run and then the parsing of the
+/// rest. Parsing stops at a BARRIER until the commands before it ran, and while COMMAND_RING_SIZE commands wait.
+/// @param worker Index of the calling worker.
+/// @param job Job file to parse.
+static void parse_batch(unsigned int worker, struct FileJob *job) {
+    for (size_t i = 0; i < STEAL_BATCH_SIZE; i++) {
+        // The command that makes room picks the file up again
+        pthread_mutex_lock(&job->lock);
+        int full = job->num_tasks >= COMMAND_RING_SIZE;
+        if (full) {
+            job->resume_below = COMMAND_RING_SIZE;
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (full) {
+            return;
+        }
+
+        struct Task *task = malloc(sizeof(struct Task));
+        enum Command cmd = EOC;
+
+        if (task == NULL) {
+            fprintf(stderr, "Failed to allocate memory\n");
+        } else {
+            cmd = decode_command(&job->jobs, &task->record, pool.num_workers);
+        }
+
+        if (cmd == CMD_BARRIER || cmd == EOC) {
+            free(task);
+
+            pthread_mutex_lock(&job->lock);
+            int busy = job->num_tasks > 0;
+            if (cmd == EOC) {
+                job->parsed = 1;
+            } else if (busy) {
+                job->resume_below = 1;
+            }
+            pthread_mutex_unlock(&job->lock);
+
+            // The last command to finish picks the file up again
+            if (busy) {
+                return;
+            }
+            if (cmd == EOC) {
+                finish_job(job);
+                return;
+            }
+            continue;
+        }
+
+        task->job = job;
+        task->parse = 0;
+        task->next_in_file = NULL;
+        task->queued = 0;
+
+        pthread_mutex_lock(&job->lock);
+        if (job->tail != NULL) {
+            job->tail->next_in_file = task;
+        } else {
+            job->head = task;
+        }
+        job->tail = task;
+        job->num_tasks++;
+        queue_ready(worker, job);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    push_task(worker, &job->parse_task);
+}
+
+/// Runs a command of a job file, then queues the ones it held back and resumes parsing if it was waiting for it.
+/// @param worker Index of the calling worker.
+/// @param task Command to run, freed afterwards.
+static void run_task(unsigned int worker, struct Task *task) {
+    struct FileJob *job = task->job;
+
+    if (task->parse) {
+        parse_batch(worker, job);
+        return;
+    }
+
+    // Workers are not tied to thread ids, a targeted WAIT holds up whichever worker takes it
+    if (task->record.cmd == CMD_WAIT) {
+        fprintf(stderr, "Waiting...\n");
+        ems_wait(task->record.delay);
+    } else {
+        run_command(job->state, job->output_fd, &task->record);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    struct Task **link = &job->head;
+    struct Task *previous = NULL;
+    while (*link != task) {
+        previous = *link;
+        link = &previous->next_in_file;
+    }
+    *link = task->next_in_file;
+    if (job->tail == task) {
+        job->tail = previous;
+    }
+    job->num_tasks--;
+
+    int resume = job->num_tasks < job->resume_below;
+    int finish = job->num_tasks == 0 && job->parsed;
+    if (resume) {
+        job->resume_below = 0;
+    }
+    queue_ready(worker, job);
+    pthread_mutex_unlock(&job->lock);
+    free(task);
+
+    if (resume) {
+        parse_batch(worker, job);
+    } else if (finish) {
+        finish_job(job);
+    }
+}
+
+// Function executed by each worker of the shared pool
+void *worker_function(void *worker_ptr) {
+    unsigned int worker = *(unsigned int *)worker_ptr;
+
+    while (1) {
+        struct Task *task = find_task(worker);
+        if (task != NULL) {
+            run_task(worker, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        atomic_fetch_add(&pool.idle, 1);
+        while (atomic_load(&pool.queued) == 0 && atomic_load(&pool.remaining) > 0) {
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        atomic_fetch_sub(&pool.idle, 1);
+        int done = atomic_load(&pool.queued) == 0;
+        pthread_mutex_unlock(&pool.lock);
+
+        if (done) {
+            return NULL;
+        }
+    }
+}
+
+/// Builds the paths of a job file and of its output and opens both.
+/// @param dir_path Directory holding the job file.
+/// @param file_name Name of the job file, ending in ".jobs".
+/// @param input_fd Pointer to store the descriptor of the job file in, -1 if it could not be opened.
+/// @param output_fd Pointer to store the descriptor of the output in, -1 if it could not be opened.
+static void open_job_paths(const char *dir_path, const char *file_name, int *input_fd, int *output_fd) {
+    // Construct paths for input and output files
+    size_t path_length_out = strlen(dir_path) + 1 + strlen(file_name) - 4 + strlen("out") + 1;
+    size_t path_length_inp = strlen(dir_path) + 1 + strlen(file_name) +1;
+    char output_file_path[path_length_out];
+    char input_file_path[path_length_inp];
+    strcpy(output_file_path, dir_path);
+    strcpy(input_file_path, dir_path);
+    strcat(input_file_path, "/");
+    strcat(output_file_path, "/");
+    strcat(input_file_path, file_name);
+    strncat(output_file_path, file_name, strlen(file_name) - 4);
+    strcat(output_file_path, "out");
+
+    // Open input and output files
+    *output_fd = open(output_file_path, O_CREAT | O_TRUNC | O_WRONLY , S_IRUSR | S_IWUSR);
+    *input_fd = open(input_file_path, O_RDONLY);
+}
+
+/// Runs every job file of a directory in this process, on workers that steal commands from each other so a large file
+/// keeps every worker busy once the small ones are done.
+/// @note Commands of different files run concurrently, those of one file keep the order the ring gives them.
+/// @param dir Open directory with the job files.
+/// @param dir_path Path of the directory.
+/// @param num_workers Number of workers.
+/// @return 0 if the pool ran, 1 otherwise.
+static int run_in_process(DIR *dir, const char *dir_path, unsigned int num_workers) {
+    pool.queues = calloc(num_workers, sizeof(struct TaskQueue));
+    if (pool.queues == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 1;
+    }
+    pool.num_workers = num_workers;
+    for (unsigned int i = 0; i < num_workers; i++) {
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+    }
+
+    // Files are spread over the queues before any worker starts, the idle ones steal from the rest
+    unsigned int next_queue = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+
+        // Check for files with ".jobs" extension
+        if (strstr(entry->d_name, ".jobs") == NULL) {
+            continue;
+        }
+
+        struct FileJob *job = malloc(sizeof(struct FileJob));
+        if (job == NULL) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            continue;
+        }
+
+        open_job_paths(dir_path, entry->d_name, &job->input_fd, &job->output_fd);
+
+        if (open_job_file(job->input_fd, &job->jobs) != 0) {
+            fprintf(stderr, "Failed to read job file\n");
+            close(job->input_fd);
+            close(job->output_fd);
+            free(job);
+            continue;
+        }
+
+        job->state = ems_state_create();
+        if (job->state == NULL) {
+            fprintf(stderr, "Failed to initialize EMS\n");
+            close_job_file(&job->jobs);
+            close(job->input_fd);
+            close(job->output_fd);
+            free(job);
+            continue;
+        }
+
+        pthread_mutex_init(&job->lock, NULL);
+        job->head = NULL;
+        job->tail = NULL;
+        job->num_tasks = 0;
+        job->resume_below = 0;
+        job->parsed = 0;
+        job->parse_task.job = job;
+        job->parse_task.parse = 1;
+
+        atomic_fetch_add(&pool.remaining, 1);
+        push_task(next_queue, &job->parse_task);
+        next_queue = (next_queue + 1) % num_workers;
+    }
+
+    pthread_t workers[num_workers];
+    unsigned int worker_ids[num_workers];
+
+    for (unsigned int i = 0; i < num_workers; i++) {
+        worker_ids[i] = i;
+        pthread_create(&workers[i], NULL, worker_function, (void *)&worker_ids[i]);
+    }
+
+    for (unsigned int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (unsigned int i = 0; i < num_workers; i++) {
+        pthread_mutex_destroy(&pool.queues[i].lock);
+    }
+    free(pool.queues);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
 
     int pid = 1;
-    int flag_barrier = 0;
-    int *join_ret;
     unsigned int state_access_delay_ms = STATE_ACCESS_DELAY_MS;
 
     if (argc > 4) {
@@ -227,7 +921,7 @@ int main(int argc, char *argv[]) {
     char *endptr;
     long int max_proc = strtol(argv[2], &endptr, 10);
 
-    if (*endptr != '\0' || max_proc <= 0) {
+    if (*endptr != '\0' || max_proc < 0) {
         fprintf(stderr, "Invalid MAX_PROC value\n");
         return 1;
     }
@@ -235,7 +929,30 @@ int main(int argc, char *argv[]) {
     char *endptr_1;
     long int max_threads = strtol(argv[3], &endptr_1, 10);
 
+    // Both modes size their workers by it, before any thread or file is set up
+    if (*endptr_1 != '\0' || max_threads <= 0) {
+        fprintf(stderr, "Invalid MAX_THREADS value\n");
+        return 1;
+    }
+
+    // A MAX_PROC of 0 runs every file in this process, sharing MAX_THREADS workers
+    if (max_proc == 0) {
+        DIR *dir = opendir(argv[1]);
+
+        if (dir == NULL) {
+            perror("Error opening directory");
+            return 0;
+        }
+
+        int result = run_in_process(dir, argv[1], (unsigned int)max_threads);
+
+        ems_terminate();
+        closedir(dir);
+        return result;
+    }
+
     pthread_t threads[max_threads];
+    struct ThreadArgs thread_args[max_threads];
     //pthread_t threads_ids[max_threads];
 
     int active_processes = 0; 
@@ -270,53 +987,56 @@ int main(int argc, char *argv[]) {
                 active_processes++;
             }
 
-            // Construct paths for input and output files
-            size_t path_length_out = strlen(argv[1]) + 1 + strlen(entry->d_name) - 4 + strlen("out") + 1;
-            size_t path_length_inp = strlen(argv[1]) + 1 + strlen(entry->d_name) +1;
-            char output_file_path[path_length_out];
-            char input_file_path[path_length_inp];
-            strcpy(output_file_path, argv[1]);
-            strcpy(input_file_path, argv[1]);
-            strcat(input_file_path, "/");
-            strcat(output_file_path, "/");
-            strcat(input_file_path, entry->d_name);
-            strncat(output_file_path, entry->d_name, strlen(entry->d_name) - 4);
-            strcat(output_file_path, "out");
-            
-             // Open input and output files
-            int output_fd = open(output_file_path, O_CREAT | O_TRUNC | O_WRONLY , S_IRUSR | S_IWUSR);
-            int input_fd = open(input_file_path, O_RDONLY);
+            int input_fd, output_fd;
+            open_job_paths(argv[1], entry->d_name, &input_fd, &output_fd);
 
             if (pid == 0) {
 
-              while(1){
-                  flag_barrier = 0;
-              
-                  for(int i = 0; i < max_threads; i++){
-                    struct ThreadArgs *args = (struct ThreadArgs *)malloc(sizeof(struct ThreadArgs));
-                    args->in_fd = input_fd;
-                    args->out_fd = output_fd;
-                    args->thread_id = i+1;
-
-
-                    pthread_create(&threads[i], NULL, thread_function, (void *)args);
-                    //threads_ids[i] = pthread_self;
-                  }
-                  
-                  for(int i = 0; i < max_threads; i++){
-                    pthread_join(threads[i], (void**) &join_ret);
-                    if(join_ret == (void *)1){
-                      flag_barrier = 1;
-                    }
-                  }
-
-                  if(flag_barrier == 0){
-                    break;
-                  }else{
-                    barrierFlag = 0;
-                  }
+              // Loaded whole, so parsing under the mutex never waits on the disk
+              struct JobFile jobs;
+              if (open_job_file(input_fd, &jobs) != 0) {
+                fprintf(stderr, "Failed to read job file\n");
+                close(input_fd);
+                close(output_fd);
+                continue;
+              }
+
+              ring.executors = calloc((size_t)max_threads + 1, sizeof(struct Executor));
+              ring.num_executors = (unsigned int)max_threads;
+              if (ring.executors == NULL) {
+                fprintf(stderr, "Failed to allocate memory\n");
+                close_job_file(&jobs);
+                close(input_fd);
+                close(output_fd);
+                continue;
+              }
+
+              if (pthread_barrier_init(&ring.phase, NULL, (unsigned int)max_threads) != 0) {
+                fprintf(stderr, "Failed to initialize barrier\n");
+                free(ring.executors);
+                close_job_file(&jobs);
+                close(input_fd);
+                close(output_fd);
+                continue;
+              }
+
+              // The executors live for the whole file while this thread parses it
+              for(int i = 0; i < max_threads; i++){
+                thread_args[i].out_fd = output_fd;
+                thread_args[i].thread_id = i+1;
+
+                pthread_create(&threads[i], NULL, thread_function, (void *)&thread_args[i]);
+              }
+
+              parse_jobs(&jobs, (unsigned int)max_threads);
+
+              for(int i = 0; i < max_threads; i++){
+                pthread_join(threads[i], NULL);
               }
 
+              pthread_barrier_destroy(&ring.phase);
+              free(ring.executors);
+              close_job_file(&jobs);
               close(input_fd);
               close(output_fd);
 
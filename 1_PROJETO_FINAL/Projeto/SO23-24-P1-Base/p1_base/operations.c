@@ -5,20 +5,21 @@
 #include <string.h>
 
 #include <pthread.h>
-// Mutex and read-write locks for thread synchronization
-// global arg evento
-// global event list
-// global output
-pthread_mutex_t mutex_event = PTHREAD_MUTEX_INITIALIZER;
-pthread_rwlock_t rwlock_event_list = PTHREAD_RWLOCK_INITIALIZER; 
-pthread_rwlock_t rwlock_output = PTHREAD_RWLOCK_INITIALIZER;
 
 #include "eventlist.h"
+#include "operations.h"
 
 #define BUFFER_SIZE 20
 
-// Global variables for event list and state access delay
-static struct EventList* event_list = NULL;
+// Events of one state with the locks guarding them
+struct EmsState {
+  struct EventList* event_list;
+  pthread_rwlock_t rwlock_event_list;  // Read-write lock on the event list
+  pthread_rwlock_t rwlock_output;      // Keeps the lines of a SHOW or LIST together in the output
+};
+
+// Global variables for the state ems_init() creates and state access delay
+static struct EmsState* default_state = NULL;
 static unsigned int state_access_delay_ms = 0;
 
 // Function to format event information into a string
@@ -42,13 +43,14 @@ static struct timespec delay_to_timespec(unsigned int delay_ms) {
 
 /// Gets the event with the given ID from the state.
 /// @note Will wait to simulate a real system accessing a costly memory resource.
+/// @param state State to search.
 /// @param event_id The ID of the event to get.
 /// @return Pointer to the event if found, NULL otherwise.
-static struct Event* get_event_with_delay(unsigned int event_id) {
+static struct Event* get_event_with_delay(struct EmsState* state, unsigned int event_id) {
   struct timespec delay = delay_to_timespec(state_access_delay_ms);
   nanosleep(&delay, NULL);  // Should not be removed
 
-  return get_event(event_list, event_id);
+  return get_event(state->event_list, event_id);
 }
 
 /// Gets the seat with the given index from the state.
@@ -56,7 +58,7 @@ static struct Event* get_event_with_delay(unsigned int event_id) {
 /// @param event Event to get the seat from.
 /// @param index Index of the seat to get.
 /// @return Pointer to the seat.
-static unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
+static _Atomic unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
   struct timespec delay = delay_to_timespec(state_access_delay_ms);
   nanosleep(&delay, NULL);  // Should not be removed
 
@@ -72,49 +74,80 @@ static unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
 
+/// Gets the state an operation acts on.
+/// @param state State given to the operation, NULL for the one ems_init() created.
+/// @return The state, NULL if it was not initialized.
+static struct EmsState* resolve_state(struct EmsState* state) { return state != NULL ? state : default_state; }
+
+struct EmsState* ems_state_create() {
+  struct EmsState* state = malloc(sizeof(struct EmsState));
+  if (state == NULL) {
+    return NULL;
+  }
+
+  state->event_list = create_list();
+  if (state->event_list == NULL) {
+    free(state);
+    return NULL;
+  }
+
+  pthread_rwlock_init(&state->rwlock_event_list, NULL);
+  pthread_rwlock_init(&state->rwlock_output, NULL);
+  return state;
+}
+
+void ems_state_destroy(struct EmsState* state) {
+  free_list(state->event_list);
+  pthread_rwlock_destroy(&state->rwlock_event_list);
+  pthread_rwlock_destroy(&state->rwlock_output);
+  free(state);
+}
+
 // Initialization function for EMS state
 int ems_init(unsigned int delay_ms) {
-  if (event_list != NULL) {
+  if (default_state != NULL) {
     printf("EMS state has already been initialized\n");
     return 1;
   }
 
-  event_list = create_list();
+  default_state = ems_state_create();
   state_access_delay_ms = delay_ms;
 
-  return event_list == NULL;
+  return default_state == NULL;
 }
 
 
 // Termination function for EMS state
 int ems_terminate() {
-  if (event_list == NULL) {
+  if (default_state == NULL) {
     printf("EMS state must be initialized\n");
     return 1;
   }
 
-  free_list(event_list);
+  ems_state_destroy(default_state);
+  default_state = NULL;
   
   return 0;
 }
 
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+int ems_create(struct EmsState* state, unsigned int event_id, size_t num_rows, size_t num_cols) {
 
   // Check if EMS state has been initialized
-  if (event_list == NULL) {
+  state = resolve_state(state);
+  if (state == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
     
   // Read lock on the event list to check if the event already exists
-  pthread_rwlock_rdlock(&rwlock_event_list);
-  if (get_event_with_delay(event_id) != NULL) {
+  pthread_rwlock_rdlock(&state->rwlock_event_list);
+  if (get_event_with_delay(state, event_id) != NULL) {
     fprintf(stderr, "Event already exists\n");
-    pthread_rwlock_unlock(&rwlock_event_list);
+    pthread_rwlock_unlock(&state->rwlock_event_list);
     return 1;
   }
-  pthread_rwlock_unlock(&rwlock_event_list);
+  pthread_rwlock_unlock(&state->rwlock_event_list);
 
   // Allocate memory for a new event
   struct Event* event = malloc(sizeof(struct Event));
@@ -126,16 +159,14 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
     return 1;
   }
 
-  // Lock to set event details
-  pthread_mutex_lock(&mutex_event);
+  // The event is private until it is appended, no lock needed to set its details
   event->id = event_id;
   event->rows = num_rows;
   event->cols = num_cols;
-  event->reservations = 0;
+  atomic_init(&event->reservations, 0);
 
-  // Allocate memory for event data (seats)
-  event->data = malloc(num_rows * num_cols * sizeof(unsigned int));
-  pthread_mutex_unlock(&mutex_event);
+  // Allocate memory for event data (seats), zeroed pages mean every seat starts unreserved
+  event->data = calloc(num_rows * num_cols, sizeof(unsigned int));
 
   // Check if memory allocation for event data was successful
   if (event->data == NULL) {
@@ -144,84 +175,49 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
     return 1;
   }
 
-  // Allocate memory for mutexes to control access to each seat
-  event->mutex_seats = malloc(num_rows * num_cols * sizeof(pthread_mutex_t));
-
-  // Initialize mutexes for each seat
-  for (size_t i = 0; i < num_rows * num_cols; i++) {
-    if (pthread_mutex_init(&event->mutex_seats[i], NULL) != 0) {
-      fprintf(stderr, "Error initializing mutex for seat %zu\n", i);
-      free(event->mutex_seats);
-      free(event->data);
-      free(event);
-      return 1;
-    }
-    event->data[i] = 0; // Initialize seat as unreserved
-  }
   // Write lock on the event list to append the new event
-  pthread_rwlock_wrlock(&rwlock_event_list);
-  if (append_to_list(event_list, event) != 0) {
+  pthread_rwlock_wrlock(&state->rwlock_event_list);
+  if (append_to_list(state->event_list, event) != 0) {
     fprintf(stderr, "Error appending event to list\n");
-    free(event->data);
+    free((void*)event->data);
     free(event);
-    pthread_rwlock_unlock(&rwlock_event_list);
+    pthread_rwlock_unlock(&state->rwlock_event_list);
     return 1;
   }
-  pthread_rwlock_unlock(&rwlock_event_list);
+  pthread_rwlock_unlock(&state->rwlock_event_list);
   return 0;
 }
 
-int compare_coordinates(const void* a, const void* b) {
-    // Extract ys values
-    size_t y1 = *((const size_t*)a + 1);
-    size_t y2 = *((const size_t*)b + 1);
-
-    if (y1 < y2) {
-        return -1;
-    } else if (y1 > y2) {
-        return 1;
-    } else {
-        // If ys are equal, compare xs values
-        size_t x1 = *((const size_t*)a);
-        size_t x2 = *((const size_t*)b);
-
-        if (x1 < x2) {
-            return -1;
-        } else if (x1 > x2) {
-            return 1;
-        } else {
-            return 0;
-        }
-    }
-}
+static int compare_indices(const void* a, const void* b) {
+  size_t index_a = *(const size_t*)a;
+  size_t index_b = *(const size_t*)b;
 
-int has_duplicate_coordinates(size_t num_seats, size_t* xs, size_t* ys) {
-    for (size_t i = 1; i < num_seats; ++i) {
-        // Check for duplicates in xy
-        if (xs[i] == xs[i - 1] && ys[i] == ys[i - 1]) {
-            return 1;
-        }
-    }
+  return (index_a > index_b) - (index_a < index_b);
+}
 
-    return 0; 
+/// Releases the seats claimed by a reservation that could not complete.
+/// @param event Event the seats belong to.
+/// @param num_claimed Number of seats claimed so far.
+/// @param indices Seat indices, in claim order.
+static void release_seats(struct Event* event, size_t num_claimed, size_t* indices) {
+  for (size_t i = 0; i < num_claimed; i++) {
+    atomic_store_explicit(&event->data[indices[i]], 0, memory_order_release);
+  }
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+int ems_reserve(struct EmsState* state, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
 
-  // Flag to track reservation success
-  int flag_reserve = 1;
-  int flag_iteration = 0;
- 
   // Check if EMS state has been initialized
-  if (event_list == NULL) {
+  state = resolve_state(state);
+  if (state == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
   // Read lock on the event list to get the event details
-  pthread_rwlock_rdlock(&rwlock_event_list);
-  struct Event* event = get_event_with_delay(event_id);
-  pthread_rwlock_unlock(&rwlock_event_list);
+  pthread_rwlock_rdlock(&state->rwlock_event_list);
+  struct Event* event = get_event_with_delay(state, event_id);
+  pthread_rwlock_unlock(&state->rwlock_event_list);
 
   // Check if the event exists
   if (event == NULL) {
@@ -229,84 +225,66 @@ int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys)
     return 1;
   }
 
-  // Sort seat coordinates for proper comparison
-  qsort(xs, num_seats, sizeof(size_t), compare_coordinates);
-  qsort(ys, num_seats, sizeof(size_t), compare_coordinates);
+  size_t indices[num_seats];
 
-
-  // Check for duplicate seat coordinates
-  if(has_duplicate_coordinates(num_seats, xs, ys) == 1){
-
-    return 0;
-  }
-
-  // Iterate through seats to be reserved
+  // Check if the seat coordinates are valid
   for (size_t i = 0; i < num_seats; i++) {
     size_t row = xs[i];
     size_t col = ys[i];
 
-    // Check if the seat coordinates are valid
     if (row <= 0 || row > event->rows || col <= 0 || col > event->cols) {
-      flag_reserve = 0;
-      flag_iteration = (int)i - 1;
       fprintf(stderr, "Invalid seat\n");
-      break;
+      return 0;
     }
 
-    // Lock the mutex for the seat
-    pthread_mutex_lock(&event->mutex_seats[seat_index(event, row, col)]);
-
-    // Check if the seat is already reserved
-    if (*get_seat_with_delay(event, seat_index(event, row, col)) != 0) {
-      flag_reserve = 0;
-      flag_iteration = (int)i;
-      fprintf(stderr, "Seat already reserved\n");
-      break;
-    }
+    indices[i] = seat_index(event, row, col);
   }
 
-    // If reservation is successful, update the seats
-    if(flag_reserve == 1){
+  // Claim seats in ascending index order, so two overlapping reservations always collide on the same first seat and
+  // one of them backs off instead of both holding half of the set
+  qsort(indices, num_seats, sizeof(size_t), compare_indices);
 
-        // Lock global event mutex for reservation ID assignment
-        pthread_mutex_lock(&mutex_event);
-        unsigned int reservation_id = ++event->reservations;
-        pthread_mutex_unlock(&mutex_event);
+  // Check for duplicate seat coordinates
+  for (size_t i = 1; i < num_seats; i++) {
+    if (indices[i] == indices[i - 1]) {
+      return 0;
+    }
+  }
 
-        // Update each seat with the reservation ID
-        for (size_t j = 0; j < num_seats; j++) {
+  for (size_t i = 0; i < num_seats; i++) {
+    unsigned int expected = 0;
 
-            size_t row_ = xs[j];
-            size_t col_ = ys[j];
-            *get_seat_with_delay(event, seat_index(event, row_, col_)) = reservation_id;
-            pthread_mutex_unlock(&event->mutex_seats[seat_index(event, row_, col_)]);
-        }
+    if (!atomic_compare_exchange_strong_explicit(get_seat_with_delay(event, indices[i]), &expected, SEAT_PENDING,
+                                                 memory_order_acq_rel, memory_order_relaxed)) {
+      fprintf(stderr, "Seat already reserved\n");
+      release_seats(event, i, indices);
+      return 0;
+    }
+  }
 
-    }else if(flag_reserve == 0){
-        // Reservation failed, unlock the seats that were locked
-        for (size_t h = 0; (int)h <= flag_iteration; h++) {
+  // Every seat is ours, the id is only taken now so failed attempts leave no gaps
+  unsigned int reservation_id = atomic_fetch_add_explicit(&event->reservations, 1, memory_order_relaxed) + 1;
 
-            size_t row_ = xs[h];
-            size_t col_ = ys[h];
-            pthread_mutex_unlock(&event->mutex_seats[seat_index(event, row_, col_)]);
-        }
-    }
+  for (size_t i = 0; i < num_seats; i++) {
+    atomic_store_explicit(get_seat_with_delay(event, indices[i]), reservation_id, memory_order_release);
+  }
 
   return 0;
 }
 
-int ems_show(int fd, unsigned int event_id) {
+int ems_show(struct EmsState* state, int fd, unsigned int event_id) {
 
 // Check if EMS state has been initialized
-  if (event_list == NULL) {
+  state = resolve_state(state);
+  if (state == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
   // Read lock on the event list to get the event details
-  pthread_rwlock_rdlock(&rwlock_event_list);
-  struct Event* event = get_event_with_delay(event_id);
-  pthread_rwlock_unlock(&rwlock_event_list);
+  pthread_rwlock_rdlock(&state->rwlock_event_list);
+  struct Event* event = get_event_with_delay(state, event_id);
+  pthread_rwlock_unlock(&state->rwlock_event_list);
 
   // Check if the event exists
   if (event == NULL) {
@@ -315,20 +293,18 @@ int ems_show(int fd, unsigned int event_id) {
   }
 
   // Write lock on the output to update the file descriptor
-  pthread_rwlock_wrlock(&rwlock_output);
+  pthread_rwlock_wrlock(&state->rwlock_output);
 
   // Iterate through rows and columns to print seat information
   for (size_t i = 1; i <= event->rows; i++) {
     for (size_t j = 1; j <= event->cols; j++) {
-      unsigned int* seat = get_seat_with_delay(event, seat_index(event, i, j));
+      unsigned int seat = atomic_load_explicit(get_seat_with_delay(event, seat_index(event, i, j)),
+                                               memory_order_acquire);
       char seat_str[BUFFER_SIZE];
-      // Lock the mutex for the seat      
-      pthread_mutex_lock(&event->mutex_seats[seat_index(event, i, j)]);
-     // Format seat information and write to the file descriptor
-      format_seat_str(seat_str, *seat);
+
+      // A seat still being claimed is not reserved yet
+      format_seat_str(seat_str, seat == SEAT_PENDING ? 0 : seat);
       write(fd, seat_str, strlen(seat_str));
-      // Unlock the mutex for the seat
-      pthread_mutex_unlock(&event->mutex_seats[seat_index(event, i, j)]);
 
       if (j < event->cols) {
         write(fd, " ", 1);
@@ -338,39 +314,40 @@ int ems_show(int fd, unsigned int event_id) {
     write(fd,"\n", 1);
   }
   // Unlock the output
-  pthread_rwlock_unlock(&rwlock_output);
+  pthread_rwlock_unlock(&state->rwlock_output);
   return 0;
 }
 
-int ems_list_events(int fd){
+int ems_list_events(struct EmsState* state, int fd){
 
   // Check if EMS state has been initialized
-  if (event_list == NULL) {
+  state = resolve_state(state);
+  if (state == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
   
     return 1;
   }
-  if (event_list->head == NULL) {
+  if (state->event_list->head == NULL) {
     write(fd, "No events\n", 10);
   
     return 0;
   }
   // Read lock on the event list to iterate through events
-  pthread_rwlock_rdlock(&rwlock_event_list);
-  struct ListNode* current = event_list->head;
-  pthread_rwlock_unlock(&rwlock_event_list);
+  pthread_rwlock_rdlock(&state->rwlock_event_list);
+  struct ListNode* current = state->event_list->head;
+  pthread_rwlock_unlock(&state->rwlock_event_list);
   // Iterate through events in the event list
   while (current != NULL) {
     char event_str[BUFFER_SIZE];
     format_event_str(event_str, current->event->id);
-    pthread_rwlock_wrlock(&rwlock_output);
+    pthread_rwlock_wrlock(&state->rwlock_output);
     format_event_str(event_str, current->event->id);
     write(fd, event_str, strlen(event_str));
-    pthread_rwlock_unlock(&rwlock_output);
+    pthread_rwlock_unlock(&state->rwlock_output);
      // Read lock on the event list to move to the next event
-    pthread_rwlock_rdlock(&rwlock_event_list);
+    pthread_rwlock_rdlock(&state->rwlock_event_list);
     current = current->next;
-    pthread_rwlock_unlock(&rwlock_event_list);
+    pthread_rwlock_unlock(&state->rwlock_event_list);
   }
 
   return 0;
@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 
+// Events and locks of one independent EMS state, operations given NULL act on the one ems_init() creates
+struct EmsState;
+
 /// Initializes the EMS state.
 /// @param delay_ms State access delay in milliseconds.
 /// @return 0 if the EMS state was initialized successfully, 1 otherwise.
@@ -11,29 +14,42 @@ int ems_init(unsigned int delay_ms);
 /// Destroys the EMS state.
 int ems_terminate();
 
+/// Creates an EMS state with no events, independent of every other state.
+/// @note Needs ems_init() first for the state access delay.
+/// @return Newly created state, NULL on failure.
+struct EmsState *ems_state_create();
+
+/// Destroys an EMS state created by ems_state_create().
+/// @param state State to destroy, no operation may be using it.
+void ems_state_destroy(struct EmsState *state);
+
 /// Creates a new event with the given id and dimensions.
+/// @param state State to create the event in, NULL for the default one.
 /// @param event_id Id of the event to be created.
 /// @param num_rows Number of rows of the event to be created.
 /// @param num_cols Number of columns of the event to be created.
 /// @return 0 if the event was created successfully, 1 otherwise.
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
+int ems_create(struct EmsState *state, unsigned int event_id, size_t num_rows, size_t num_cols);
 
 /// Creates a new reservation for the given event.
+/// @param state State the event belongs to, NULL for the default one.
 /// @param event_id Id of the event to create a reservation for.
 /// @param num_seats Number of seats to reserve.
 /// @param xs Array of rows of the seats to reserve.
 /// @param ys Array of columns of the seats to reserve.
 /// @return 0 if the reservation was created successfully, 1 otherwise.
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
+int ems_reserve(struct EmsState *state, unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
 
 /// Prints the given event.
+/// @param state State the event belongs to, NULL for the default one.
 /// @param event_id Id of the event to print.
 /// @return 0 if the event was printed successfully, 1 otherwise.
-int ems_show(int fd, unsigned int event_id);
+int ems_show(struct EmsState *state, int fd, unsigned int event_id);
 
 /// Prints all the events.
+/// @param state State whose events are printed, NULL for the default one.
 /// @return 0 if the events were printed successfully, 1 otherwise.
-int ems_list_events(int fd);
+int ems_list_events(struct EmsState *state, int fd);
 
 /// Waits for a given amount of time.
 /// @param delay_us Delay in milliseconds.
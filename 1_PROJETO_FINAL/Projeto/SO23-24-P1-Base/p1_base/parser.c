@@ -3,33 +3,120 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "constants.h"
 
-static int read_uint(int fd, unsigned int *value, char *next) {
-  char buf[16];
+int open_job_file(int fd, struct JobFile *file) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return 1;
+  }
+
+  file->data = NULL;
+  file->size = 0;
+  file->offset = 0;
+  file->mapped = 0;
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      file->data = data;
+      file->size = (size_t)st.st_size;
+      file->mapped = 1;
+      return 0;
+    }
+  }
 
-  int i = 0;
+  // Not something that can be mapped, read it in blocks instead
+  size_t capacity = 0;
+  char *buffer = NULL;
   while (1) {
-    if (read(fd, buf + i, 1) == 0) {
-      *next = '\0';
+    if (file->size == capacity) {
+      capacity = capacity == 0 ? JOB_READ_BLOCK_SIZE : 2 * capacity;
+      char *grown = realloc(buffer, capacity);
+      if (grown == NULL) {
+        free(buffer);
+        return 1;
+      }
+      buffer = grown;
+    }
+
+    ssize_t bytes_read = read(fd, buffer + file->size, capacity - file->size);
+    if (bytes_read == -1) {
+      free(buffer);
+      return 1;
+    }
+    if (bytes_read == 0) {
       break;
     }
+    file->size += (size_t)bytes_read;
+  }
+
+  file->data = buffer;
+  return 0;
+}
+
+void close_job_file(struct JobFile *file) {
+  if (file->mapped) {
+    munmap((void *)file->data, file->size);
+  } else {
+    free((void *)file->data);
+  }
 
-    *next = buf[i];
+  file->data = NULL;
+  file->size = 0;
+  file->offset = 0;
+}
+
+/// Takes the next byte of a job file, like a one byte read().
+/// @return 1 if a byte was taken, 0 at the end of the file.
+static int take_char(struct JobFile *file, char *ch) {
+  if (file->offset == file->size) {
+    return 0;
+  }
+
+  *ch = file->data[file->offset++];
+  return 1;
+}
+
+/// Takes up to count bytes of a job file, like a read() of that many bytes.
+/// @return Number of bytes taken, less than count only at the end of the file.
+static size_t take_chars(struct JobFile *file, char *buf, size_t count) {
+  size_t left = file->size - file->offset;
+  if (count > left) {
+    count = left;
+  }
+
+  memcpy(buf, file->data + file->offset, count);
+  file->offset += count;
+  return count;
+}
 
-    if (buf[i] > '9' || buf[i] < '0') {
-      buf[i] = '\0';
+static int read_uint(struct JobFile *file, unsigned int *value, char *next) {
+  unsigned long ul = 0;
+  int overflow = 0;
+
+  while (1) {
+    if (!take_char(file, next)) {
+      *next = '\0';
       break;
     }
 
-    i++;
-  }
+    if (*next > '9' || *next < '0') {
+      break;
+    }
 
-  unsigned long ul = strtoul(buf, NULL, 10);
+    ul = ul * 10 + (unsigned long)(*next - '0');
+    if (ul > UINT_MAX) {
+      overflow = 1;
+      ul = 0;
+    }
+  }
 
-  if (ul > UINT_MAX) {
+  if (overflow) {
     return 1;
   }
 
@@ -38,121 +125,120 @@ static int read_uint(int fd, unsigned int *value, char *next) {
   return 0;
 }
 
-static void cleanup(int fd) {
-  char ch;
-  while (read(fd, &ch, 1) == 1 && ch != '\n')
-    ;
+static void cleanup(struct JobFile *file) {
+  const char *newline = memchr(file->data + file->offset, '\n', file->size - file->offset);
+  file->offset = newline == NULL ? file->size : (size_t)(newline - file->data) + 1;
 }
 
-enum Command get_next(int fd) {
+enum Command get_next(struct JobFile *file) {
   char buf[16];
-  if (read(fd, buf, 1) != 1) {
+  if (take_char(file, buf) != 1) {
     return EOC;
   }
 
   switch (buf[0]) {
     case 'C':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
-        cleanup(fd);
+      if (take_chars(file, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_CREATE;
 
     case 'R':
-      if (read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
-        cleanup(fd);
+      if (take_chars(file, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_RESERVE;
 
     case 'S':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
-        cleanup(fd);
+      if (take_chars(file, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_SHOW;
 
     case 'L':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
-        cleanup(fd);
+      if (take_chars(file, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
-        cleanup(fd);
+      if (take_chars(file, buf + 4, 1) != 0 && buf[4] != '\n') {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_LIST_EVENTS;
 
     case 'B':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
-        cleanup(fd);
+      if (take_chars(file, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
-        cleanup(fd);
+      if (take_chars(file, buf + 7, 1) != 0 && buf[7] != '\n') {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_BARRIER;
 
     case 'W':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
-        cleanup(fd);
+      if (take_chars(file, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_WAIT;
 
     case 'H':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
-        cleanup(fd);
+      if (take_chars(file, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
-        cleanup(fd);
+      if (take_chars(file, buf + 4, 1) != 0 && buf[4] != '\n') {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_HELP;
 
     case '#':
-      cleanup(fd);
+      cleanup(file);
       return CMD_EMPTY;
 
     case '\n':
       return CMD_EMPTY;
 
     default:
-      cleanup(fd);
+      cleanup(file);
       return CMD_INVALID;
   }
 }
 
-int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_cols) {
+int parse_create(struct JobFile *file, unsigned int *event_id, size_t *num_rows, size_t *num_cols) {
   char ch;
 
-  if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (read_uint(file, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(file);
     return 1;
   }
 
   unsigned int u_num_rows;
-  if (read_uint(fd, &u_num_rows, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (read_uint(file, &u_num_rows, &ch) != 0 || ch != ' ') {
+    cleanup(file);
     return 1;
   }
   *num_rows = (size_t)u_num_rows;
 
   unsigned int u_num_cols;
-  if (read_uint(fd, &u_num_cols, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (read_uint(file, &u_num_cols, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
     return 1;
   }
   *num_cols = (size_t)u_num_cols;
@@ -160,44 +246,44 @@ int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_c
   return 0;
 }
 
-size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys) {
+size_t parse_reserve(struct JobFile *file, size_t max, unsigned int *event_id, size_t *xs, size_t *ys) {
   char ch;
 
-  if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (read_uint(file, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(file);
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || ch != '[') {
-    cleanup(fd);
+  if (take_char(file, &ch) != 1 || ch != '[') {
+    cleanup(file);
     return 0;
   }
 
   size_t num_coords = 0;
   while (num_coords < max) {
-    if (read(fd, &ch, 1) != 1 || ch != '(') {
-      cleanup(fd);
+    if (take_char(file, &ch) != 1 || ch != '(') {
+      cleanup(file);
       return 0;
     }
 
     unsigned int x;
-    if (read_uint(fd, &x, &ch) != 0 || ch != ',') {
-      cleanup(fd);
+    if (read_uint(file, &x, &ch) != 0 || ch != ',') {
+      cleanup(file);
       return 0;
     }
     xs[num_coords] = (size_t)x;
 
     unsigned int y;
-    if (read_uint(fd, &y, &ch) != 0 || ch != ')') {
-      cleanup(fd);
+    if (read_uint(file, &y, &ch) != 0 || ch != ')') {
+      cleanup(file);
       return 0;
     }
     ys[num_coords] = (size_t)y;
 
     num_coords++;
 
-    if (read(fd, &ch, 1) != 1 || (ch != ' ' && ch != ']')) {
-      cleanup(fd);
+    if (take_char(file, &ch) != 1 || (ch != ' ' && ch != ']')) {
+      cleanup(file);
       return 0;
     }
 
@@ -207,45 +293,45 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
   }
 
   if (num_coords == max) {
-    cleanup(fd);
+    cleanup(file);
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (take_char(file, &ch) != 1 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
     return 0;
   }
 
   return num_coords;
 }
 
-int parse_show(int fd, unsigned int *event_id) {
+int parse_show(struct JobFile *file, unsigned int *event_id) {
   char ch;
 
-  if (read_uint(fd, event_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (read_uint(file, event_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
     return 1;
   }
 
   return 0;
 }
 
-int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
+int parse_wait(struct JobFile *file, unsigned int *delay, unsigned int *thread_id) {
   char ch;
 
-  if (read_uint(fd, delay, &ch) != 0) {
-    cleanup(fd);
+  if (read_uint(file, delay, &ch) != 0) {
+    cleanup(file);
     return -1;
   }
 
   if (ch == ' ') {
     if (thread_id == NULL) {
-      cleanup(fd);
+      cleanup(file);
       return 0;
     }
 
-    if (read_uint(fd, thread_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-      cleanup(fd);
+    if (read_uint(file, thread_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+      cleanup(file);
       return -1;
     }
 
@@ -253,7 +339,7 @@ int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
   } else if (ch == '\n' || ch == '\0') {
     return 0;
   } else {
-    cleanup(fd);
+    cleanup(file);
     return -1;
   }
 }
@@ -3,6 +3,16 @@
 
 #include <stddef.h>
 
+#define JOB_READ_BLOCK_SIZE 65536  // Bytes read at a time from a job file that cannot be mapped
+
+// Job file held in memory whole, commands are parsed from it without any system call
+struct JobFile {
+  const char *data;  // Contents of the file
+  size_t size;       // Number of bytes in data
+  size_t offset;     // Position of the next byte to parse
+  int mapped;        // Whether data is a mapping of the file, otherwise it was allocated
+};
+
 enum Command {
   CMD_CREATE,
   CMD_RESERVE,
@@ -16,39 +26,49 @@ enum Command {
   EOC  // End of commands
 };
 
+/// Loads a job file, mapping it if possible and reading it in blocks otherwise.
+/// @param fd File descriptor of the job file, may be closed once loaded.
+/// @param file Job file to initialize, positioned at its first byte.
+/// @return 0 if the file was loaded successfully, 1 otherwise.
+int open_job_file(int fd, struct JobFile *file);
+
+/// Releases the memory holding a job file.
+/// @param file Job file loaded by open_job_file().
+void close_job_file(struct JobFile *file);
+
 /// Reads a line and returns the corresponding command.
-/// @param fd File descriptor to read from.
+/// @param file Job file to read from.
 /// @return The command read.
-enum Command get_next(int fd);
+enum Command get_next(struct JobFile *file);
 
 /// Parses a CREATE command.
-/// @param fd File descriptor to read from.
+/// @param file Job file to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @param num_rows Pointer to the variable to store the number of rows in.
 /// @param num_cols Pointer to the variable to store the number of columns in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
-int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_cols);
+int parse_create(struct JobFile *file, unsigned int *event_id, size_t *num_rows, size_t *num_cols);
 
 /// Parses a RESERVE command.
-/// @param fd File descriptor to read from.
+/// @param file Job file to read from.
 /// @param max Maximum number of coordinates to read.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @param xs Pointer to the array to store the X coordinates in.
 /// @param ys Pointer to the array to store the Y coordinates in.
 /// @return Number of coordinates read. 0 on failure.
-size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys);
+size_t parse_reserve(struct JobFile *file, size_t max, unsigned int *event_id, size_t *xs, size_t *ys);
 
 /// Parses a SHOW command.
-/// @param fd File descriptor to read from.
+/// @param file Job file to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
-int parse_show(int fd, unsigned int *event_id);
+int parse_show(struct JobFile *file, unsigned int *event_id);
 
 /// Parses a WAIT command.
-/// @param fd File descriptor to read from.
+/// @param file Job file to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
 /// @param thread_id Pointer to the variable to store the thread ID in. May not be set.
 /// @return 0 if no thread was specified, 1 if a thread was specified, -1 on error.
-int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id);
+int parse_wait(struct JobFile *file, unsigned int *delay, unsigned int *thread_id);
 
 #endif  // EMS_PARSER_H
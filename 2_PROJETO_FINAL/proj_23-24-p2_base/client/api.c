@@ -1,24 +1,659 @@
 #include "api.h"
 #include "../common/constants.h"
 #include "../common/io.h"
+#include "../common/pool.h"
+#include "../common/shm_ring.h"
+#include "../common/wire.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
-int req_pipe_fd;
-int resp_pipe_fd;
-char req_pipe_path_[PIPE_PATH_MAX];
-char resp_pipe_path_[PIPE_PATH_MAX];
-unsigned int session_id;
+// Request sent to the server and not answered yet
+struct PendingRequest {
+  unsigned int request_id;
+  char op_code;
+  union {
+    ems_callback done;         // CREATE, RESERVE and SUBSCRIBE
+    ems_show_callback show;    // SHOW
+    ems_list_callback list;    // LIST
+    ems_batch_callback batch;  // BATCH
+  } callback;
+  void* arg;
+  unsigned int event_id;  // SHOW, whose cached grid a delta response applies to
+  int pinned;             // SHOW, sent the version of the cached grid and holds it in the cache
+};
+
+// Last grid received for an event, kept so the server only has to send what changed since
+struct ShowCache {
+  unsigned int event_id;
+  unsigned long version;
+  size_t num_rows;
+  size_t num_cols;
+  unsigned int* seats;  // NULL while the entry is empty
+  unsigned int pins;    // SHOW requests in flight that sent this event's version, another event cannot take the entry
+};
+
+// Smallest operation is a compact CREATE, the op code and three one byte varints
+#define MAX_BATCH_OPS (MAX_BATCH_SIZE / 4)
+
+// Operations are encoded as they are added, with the encoding of the connection
+struct EmsBatch {
+  size_t num_ops;
+  size_t num_seats;                // Seats of all the reservations, at most MAX_BATCH_SEATS
+  size_t size;                     // Bytes used in ops
+  char op_codes[MAX_BATCH_OPS];    // Operation of each entry, to report failures
+  char ops[MAX_BATCH_SIZE];        // Operations encoded as they are sent
+};
+
+// State of the session with the server, shared by the calling threads and the receive thread
+struct Connection {
+  int req_pipe_fd;
+  int resp_pipe_fd;
+  char req_pipe_path[PIPE_PATH_MAX];
+  char resp_pipe_path[PIPE_PATH_MAX];
+  unsigned int session_id;
+  unsigned int encoding;   // Encoding flags of requests and SHOW responses, agreed on with the server during setup
+  struct ShmChannel* shm;  // Shared memory rings, NULL when requests and responses go through the pipes
+  int is_socket;           // req_pipe_fd and resp_pipe_fd are the same SOCK_SEQPACKET connection
+
+  // Response bytes read but not parsed yet, so a response takes one read instead of one per field. Holds a whole
+  // datagram on a socket, where reading only part of one would lose the rest. Only used by the receive thread
+  char recv_buffer[SOCKET_MESSAGE_SIZE];
+  size_t recv_start;
+  size_t recv_len;
+
+  pthread_t receiver;  // Reads every response and runs its callback
+  int receiving;       // The receive thread was started
+
+  pthread_mutex_t send_mutex;  // Keeps request ids in the order requests are written
+
+  pthread_mutex_t mutex;  // Protects the fields below
+  pthread_cond_t not_full;
+  pthread_cond_t drained;
+  struct PendingRequest* pending;  // Requests in flight, oldest first, used as a circular buffer
+  size_t pending_head;
+  size_t num_pending;
+  size_t window;  // Maximum number of requests in flight
+  unsigned int next_request_id;
+  int broken;  // The receive thread stopped, no more responses will arrive
+  ems_notify_callback notify;  // Receives the reservations pushed for subscribed events
+  void* notify_arg;
+
+  // Grids are only written and read by the receive thread, senders only look at versions and pins
+  pthread_mutex_t cache_mutex;  // Protects the entries below
+  struct ShowCache cache[SHOW_CACHE_SIZE];  // Indexed by event id modulo SHOW_CACHE_SIZE
+};
+
+static struct Connection connection = {
+    .req_pipe_fd = -1,
+    .resp_pipe_fd = -1,
+    .send_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cache_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER,
+    .window = 1,
+    .next_request_id = 1,
+    .encoding = ENCODING_FIXED,
+};
+
+/// Reads exactly size bytes, pipes may return less than asked for.
+/// @return 0 if every byte was read, 1 on error or end of file.
+static int read_full(int fd, void* buffer, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t bytes_read = read(fd, (char*)buffer + done, size - done);
+    if (bytes_read == -1) {
+      if (errno == EINTR) continue;
+      perror("Error reading from response pipe");
+      return 1;
+    }
+    if (bytes_read == 0) return 1;
+    done += (size_t)bytes_read;
+  }
+  return 0;
+}
 
-int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path) {
+/// Reads exactly size bytes from the response pipe or socket, through the receive buffer.
+/// @return 0 if every byte was read, 1 on error or once the server closed the connection.
+static int read_buffered(void* buffer, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    if (connection.recv_start == connection.recv_len) {
+      ssize_t bytes_read = read(connection.resp_pipe_fd, connection.recv_buffer, sizeof(connection.recv_buffer));
+      if (bytes_read == -1) {
+        if (errno == EINTR) continue;
+        perror("Error reading from response pipe");
+        return 1;
+      }
+      if (bytes_read == 0) return 1;
+      connection.recv_start = 0;
+      connection.recv_len = (size_t)bytes_read;
+    }
+
+    size_t available = connection.recv_len - connection.recv_start;
+    size_t count = size - done < available ? size - done : available;
+    memcpy((char*)buffer + done, connection.recv_buffer + connection.recv_start, count);
+    connection.recv_start += count;
+    done += count;
+  }
+  return 0;
+}
+
+/// Reads exactly size bytes of responses, from the shared memory ring if the session has one.
+/// @return 0 if every byte was read, 1 on error or once the server closed the session.
+static int receive_bytes(void* buffer, size_t size) {
+  if (connection.shm != NULL) {
+    return shm_ring_recv(&connection.shm->responses, buffer, size, connection.resp_pipe_fd, &connection.shm->closed);
+  }
+  return read_buffered(buffer, size);
+}
+
+/// Runs the callback of a request with a failed result.
+static void fail_request(const struct PendingRequest* request) {
+  switch (request->op_code) {
+    case '5':
+      request->callback.show(1, 0, 0, NULL, request->arg);
+      break;
+    case '6':
+      request->callback.list(1, 0, NULL, request->arg);
+      break;
+    case '7':
+      request->callback.batch(1, 0, NULL, request->arg);
+      break;
+    default:
+      request->callback.done(1, request->arg);
+      break;
+  }
+}
+
+/// Reads the seats of a SHOW response, as they are or as runs depending on the encoding.
+/// @return 0 if the seats were read, 1 if the connection failed or the runs are malformed.
+static int receive_seats(unsigned int* seats, size_t num_seats) {
+  if (!(connection.encoding & ENCODING_SHOW_RUNS)) {
+    return receive_bytes(seats, num_seats * sizeof(unsigned int));
+  }
+
+  // The seats arrive as runs, expanded here so callbacks always see every seat
+  size_t runs_size;
+  if (receive_bytes(&runs_size, sizeof(size_t))) return 1;
+
+  char* runs = pool_alloc(runs_size);
+  if (runs == NULL && runs_size > 0) {
+    fprintf(stderr, "Error allocating memory for seats\n");
+    return 1;
+  }
+
+  int malformed = receive_bytes(runs, runs_size) || wire_get_seat_runs(runs, runs_size, seats, num_seats);
+  pool_free(runs);
+  return malformed;
+}
+
+/// Keeps the grid of a full SHOW response, so later ones only carry what changed.
+/// @param seats Grid received, owned by the cache if it was taken.
+/// @return 1 if the cache took the grid, 0 if its entry is held by another event and the caller still owns it.
+static int cache_grid(unsigned int event_id, unsigned long version, size_t num_rows, size_t num_cols,
+                      unsigned int* seats) {
+  struct ShowCache* cached = &connection.cache[event_id % SHOW_CACHE_SIZE];
+
+  pthread_mutex_lock(&connection.cache_mutex);
+  if (cached->seats != NULL && cached->event_id != event_id && cached->pins > 0) {
+    pthread_mutex_unlock(&connection.cache_mutex);
+    return 0;
+  }
+
+  pool_free(cached->seats);
+  cached->event_id = event_id;
+  cached->version = version;
+  cached->num_rows = num_rows;
+  cached->num_cols = num_cols;
+  cached->seats = seats;
+  pthread_mutex_unlock(&connection.cache_mutex);
+  return 1;
+}
+
+/// Reads the seats that changed since the cached grid and writes them into it.
+/// @param cached Entry the request pinned, with the same dimensions as the response.
+/// @param version Version the grid is at once the changes are applied.
+/// @return 0 if the changes were applied, 1 on error or if they fall outside the grid.
+static int receive_changes(struct ShowCache* cached, unsigned long version) {
+  size_t num_seats = cached->num_rows * cached->num_cols;
+  size_t num_ranges;
+  if (receive_bytes(&num_ranges, sizeof(size_t))) return 1;
+
+  // Every range has at least one seat
+  if (num_ranges > num_seats) {
+    fprintf(stderr, "Malformed show changes\n");
+    return 1;
+  }
+
+  size_t* bounds = pool_alloc(2 * num_ranges * sizeof(size_t));
+  if (bounds == NULL && num_ranges > 0) {
+    fprintf(stderr, "Error allocating memory for seats\n");
+    return 1;
+  }
+
+  if (receive_bytes(bounds, 2 * num_ranges * sizeof(size_t))) {
+    pool_free(bounds);
+    return 1;
+  }
+
+  size_t num_changed = 0;
+  for (size_t i = 0; i < num_ranges; i++) {
+    size_t first = bounds[2 * i], count = bounds[2 * i + 1];
+    if (count > num_seats - num_changed || first > num_seats - count) {
+      fprintf(stderr, "Malformed show changes\n");
+      pool_free(bounds);
+      return 1;
+    }
+    num_changed += count;
+  }
+
+  unsigned int* changed = pool_alloc(num_changed * sizeof(unsigned int));
+  if ((changed == NULL && num_changed > 0) || receive_seats(changed, num_changed)) {
+    pool_free(changed);
+    pool_free(bounds);
+    return 1;
+  }
+
+  pthread_mutex_lock(&connection.cache_mutex);
+  size_t offset = 0;
+  for (size_t i = 0; i < num_ranges; i++) {
+    memcpy(cached->seats + bounds[2 * i], changed + offset, bounds[2 * i + 1] * sizeof(unsigned int));
+    offset += bounds[2 * i + 1];
+  }
+  cached->version = version;
+  pthread_mutex_unlock(&connection.cache_mutex);
+
+  pool_free(changed);
+  pool_free(bounds);
+  return 0;
+}
+
+/// Reads the rest of a SHOW response and hands it to the callback.
+/// @return 0 if the response was read, 1 if the connection failed.
+static int receive_show(const struct PendingRequest* request) {
+  size_t num_rows, num_cols;
+  if (receive_bytes(&num_rows, sizeof(size_t)) ||
+      receive_bytes(&num_cols, sizeof(size_t))) {
+    return 1;
+  }
+
+  // With deltas the server says which version it sent and whether only the changes follow
+  unsigned long version = SHOW_UNKNOWN_VERSION;
+  char kind = SHOW_FULL;
+  if ((connection.encoding & ENCODING_SHOW_DELTA) &&
+      (receive_bytes(&version, sizeof(unsigned long)) || receive_bytes(&kind, 1))) {
+    return 1;
+  }
+
+  if (kind == SHOW_FULL) {
+    unsigned int* seats = pool_alloc(num_rows * num_cols * sizeof(unsigned int));
+    if (seats == NULL && num_rows * num_cols > 0) {
+      fprintf(stderr, "Error allocating memory for seats\n");
+      return 1;
+    }
+
+    if (receive_seats(seats, num_rows * num_cols)) {
+      pool_free(seats);
+      return 1;
+    }
+
+    int cached = (connection.encoding & ENCODING_SHOW_DELTA) &&
+                 cache_grid(request->event_id, version, num_rows, num_cols, seats);
+    request->callback.show(0, num_rows, num_cols, seats, request->arg);
+    if (!cached) pool_free(seats);
+    return 0;
+  }
+
+  // The rest applies to the grid whose version the request sent, which it kept in the cache
+  struct ShowCache* cached = &connection.cache[request->event_id % SHOW_CACHE_SIZE];
+  if (!request->pinned || cached->num_rows != num_rows || cached->num_cols != num_cols ||
+      (kind != SHOW_UNCHANGED && kind != SHOW_CHANGES)) {
+    fprintf(stderr, "Unexpected show response\n");
+    return 1;
+  }
+
+  if (kind == SHOW_CHANGES && receive_changes(cached, version)) return 1;
+
+  request->callback.show(0, num_rows, num_cols, cached->seats, request->arg);
+  return 0;
+}
+
+/// Reads the rest of a LIST response and hands it to the callback.
+/// @return 0 if the response was read, 1 if the connection failed.
+static int receive_list(const struct PendingRequest* request) {
+  size_t num_events;
+  if (receive_bytes(&num_events, sizeof(size_t))) return 1;
+
+  unsigned int* ids = pool_alloc(num_events * sizeof(unsigned int));
+  if (ids == NULL && num_events > 0) {
+    fprintf(stderr, "Error allocating memory for event ids\n");
+    return 1;
+  }
+
+  if (receive_bytes(ids, num_events * sizeof(unsigned int))) {
+    pool_free(ids);
+    return 1;
+  }
+
+  request->callback.list(0, num_events, ids, request->arg);
+  pool_free(ids);
+  return 0;
+}
+
+/// Reads the rest of a batch response and hands it to the callback.
+/// @return 0 if the response was read, 1 if the connection failed.
+static int receive_batch(const struct PendingRequest* request) {
+  size_t num_ops;
+  if (receive_bytes(&num_ops, sizeof(size_t))) return 1;
 
-  char request_buffer[81];
+  char* statuses = pool_alloc(num_ops);
+  if (statuses == NULL && num_ops > 0) {
+    fprintf(stderr, "Error allocating memory for batch statuses\n");
+    return 1;
+  }
+
+  if (receive_bytes(statuses, num_ops)) {
+    pool_free(statuses);
+    return 1;
+  }
+
+  request->callback.batch(0, num_ops, statuses, request->arg);
+  pool_free(statuses);
+  return 0;
+}
+
+/// Reads a reservation pushed for a subscribed event and hands it to the notify callback.
+/// @return 0 if the notification was read, 1 if the connection failed or it is malformed.
+static int receive_notice(void) {
+  unsigned int reservation_id;
+  size_t body_size;
+  if (receive_bytes(&reservation_id, sizeof(unsigned int)) || receive_bytes(&body_size, sizeof(size_t))) return 1;
+
+  if (body_size > wire_reserve_max_size(connection.encoding, MAX_RESERVATION_SIZE)) {
+    fprintf(stderr, "Malformed notification\n");
+    return 1;
+  }
+
+  char* body = pool_alloc(body_size);
+  if (body == NULL && body_size > 0) {
+    fprintf(stderr, "Error allocating memory for notification\n");
+    return 1;
+  }
+
+  // Same fields as a RESERVE, in the encoding of the connection
+  size_t offset = 0;
+  unsigned int event_id;
+  size_t num_seats;
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+  if (receive_bytes(body, body_size)) {
+    pool_free(body);
+    return 1;
+  }
+  if (wire_get_reserve(body, body_size, &offset, connection.encoding, &event_id, &num_seats) ||
+      num_seats > MAX_RESERVATION_SIZE ||
+      wire_get_seats(body, body_size, &offset, connection.encoding, num_seats, xs, ys) || offset != body_size) {
+    fprintf(stderr, "Malformed notification\n");
+    pool_free(body);
+    return 1;
+  }
+  pool_free(body);
+
+  pthread_mutex_lock(&connection.mutex);
+  ems_notify_callback notify = connection.notify;
+  void* notify_arg = connection.notify_arg;
+  pthread_mutex_unlock(&connection.mutex);
+
+  if (notify != NULL) {
+    notify(event_id, reservation_id, num_seats, xs, ys, notify_arg);
+  }
+  return 0;
+}
+
+/// Reads one response and completes the oldest request in flight with it.
+/// @return 0 if the response was handled, 1 if the connection failed.
+static int receive_response(void) {
+  unsigned int request_id;
+  if (receive_bytes(&request_id, sizeof(unsigned int))) return 1;
+
+  // Pushed by the server, not the answer to any request
+  if (request_id == 0) return receive_notice();
+
+  // Requests are queued before they are written, so the one answered is always there
+  pthread_mutex_lock(&connection.mutex);
+  if (connection.num_pending == 0) {
+    pthread_mutex_unlock(&connection.mutex);
+    fprintf(stderr, "Unexpected response to request %u\n", request_id);
+    return 1;
+  }
+  struct PendingRequest request = connection.pending[connection.pending_head];
+  pthread_mutex_unlock(&connection.mutex);
+
+  // The server answers in order, anything else means the stream is out of sync
+  if (request_id != request.request_id) {
+    fprintf(stderr, "Expected response to request %u, got %u\n", request.request_id, request_id);
+    return 1;
+  }
+
+  int status;
+  if (receive_bytes(&status, sizeof(int))) return 1;
+
+  int result = 0;
+  if (status != 0) {
+    fail_request(&request);
+  } else if (request.op_code == '5') {
+    result = receive_show(&request);
+  } else if (request.op_code == '6') {
+    result = receive_list(&request);
+  } else if (request.op_code == '7') {
+    result = receive_batch(&request);
+  } else {
+    request.callback.done(0, request.arg);
+  }
+
+  if (result != 0) return 1;
+
+  if (request.pinned) {
+    pthread_mutex_lock(&connection.cache_mutex);
+    connection.cache[request.event_id % SHOW_CACHE_SIZE].pins--;
+    pthread_mutex_unlock(&connection.cache_mutex);
+  }
+
+  // Only dropped once its callback ran, so ems_flush() also waits for the callbacks
+  pthread_mutex_lock(&connection.mutex);
+  connection.pending_head = (connection.pending_head + 1) % connection.window;
+  connection.num_pending--;
+  pthread_cond_signal(&connection.not_full);
+  if (connection.num_pending == 0) {
+    pthread_cond_broadcast(&connection.drained);
+  }
+  pthread_mutex_unlock(&connection.mutex);
+
+  return 0;
+}
+
+/// Completes requests until the server closes the response pipe or the connection fails.
+static void* receive_thread(void* arg) {
+  (void)arg;
+
+  while (receive_response() == 0) {
+  }
+
+  // Nothing else will be answered, fail whatever is still in flight
+  pthread_mutex_lock(&connection.mutex);
+  connection.broken = 1;
+  while (connection.num_pending > 0) {
+    struct PendingRequest request = connection.pending[connection.pending_head];
+    connection.pending_head = (connection.pending_head + 1) % connection.window;
+    connection.num_pending--;
+
+    pthread_mutex_unlock(&connection.mutex);
+    fail_request(&request);
+    pthread_mutex_lock(&connection.mutex);
+  }
+  pthread_cond_broadcast(&connection.not_full);
+  pthread_cond_broadcast(&connection.drained);
+  pthread_mutex_unlock(&connection.mutex);
+
+  // Buffers the responses left behind go to whichever thread allocates next
+  pool_drain();
+  return NULL;
+}
+
+/// Sends a request, first waiting for room in the window.
+/// @note The request is framed: the size of the rest of the frame, the op code, the session id, the request id and
+/// then the body.
+/// @param op_code Operation of the request.
+/// @param body Fields that follow the request header.
+/// @param body_size Size of the fields.
+/// @param pending Callback of the request, its id is filled in here.
+/// @return 0 if the request was sent, so its callback will run, 1 otherwise.
+static int send_request(char op_code, const void* body, size_t body_size, struct PendingRequest* pending) {
+  size_t header_size = sizeof(unsigned int) + 1 + sizeof(unsigned int) * 2;
+  if (header_size + body_size > MAX_FRAME_SIZE) {
+      fprintf(stderr, "Request too large\n");
+      return 1;
+  }
+
+  char* request_buffer = pool_alloc(header_size + body_size);
+  if (request_buffer == NULL) {
+      fprintf(stderr, "Error allocating memory for request_buffer\n");
+      return 1;
+  }
+
+  pthread_mutex_lock(&connection.send_mutex);
+  pthread_mutex_lock(&connection.mutex);
+
+  while (!connection.broken && connection.num_pending == connection.window) {
+    pthread_cond_wait(&connection.not_full, &connection.mutex);
+  }
+
+  if (connection.broken) {
+    pthread_mutex_unlock(&connection.mutex);
+    pthread_mutex_unlock(&connection.send_mutex);
+    pool_free(request_buffer);
+    return 1;
+  }
+
+  unsigned int request_id = connection.next_request_id++;
+  if (connection.next_request_id == 0) {
+    connection.next_request_id = 1;  // 0 marks notifications pushed by the server
+  }
+
+  // Queued before it is written, the response may arrive before write() returns
+  if (pending != NULL) {
+    pending->request_id = request_id;
+    pending->op_code = op_code;
+    connection.pending[(connection.pending_head + connection.num_pending) % connection.window] = *pending;
+    connection.num_pending++;
+  }
+
+  pthread_mutex_unlock(&connection.mutex);
+
+  unsigned int frame_size = (unsigned int)(header_size + body_size - sizeof(unsigned int));
+  memcpy(request_buffer, &frame_size, sizeof(unsigned int));
+  request_buffer[sizeof(unsigned int)] = op_code;
+  memcpy(request_buffer + sizeof(unsigned int) + 1, &connection.session_id, sizeof(unsigned int));
+  memcpy(request_buffer + sizeof(unsigned int) + 1 + sizeof(unsigned int), &request_id, sizeof(unsigned int));
+  if (body_size > 0) {
+    memcpy(request_buffer + header_size, body, body_size);
+  }
+
+  // Still under the send mutex, so requests from different threads never interleave in the pipe
+  int result = 0;
+  if (connection.shm != NULL) {
+    // The server only hears about it through a byte on the request pipe when it asked for one
+    result = shm_ring_send(&connection.shm->requests, request_buffer, header_size + body_size,
+                           connection.req_pipe_fd, 1);
+    if (result != 0) fprintf(stderr, "Error writing to request ring\n");
+  } else if (write(connection.req_pipe_fd, request_buffer, header_size + body_size) == -1) {
+      perror("Error writing to request pipe");
+      result = 1;
+  }
+
+  if (result != 0) {
+      // Take the request back so its callback never runs, unless the receive thread is already failing it
+      pthread_mutex_lock(&connection.mutex);
+      size_t tail = (connection.pending_head + connection.num_pending + connection.window - 1) % connection.window;
+      if (pending != NULL && connection.num_pending > 0 && connection.pending[tail].request_id == request_id) {
+        connection.num_pending--;
+        pthread_cond_signal(&connection.not_full);
+        if (connection.num_pending == 0) {
+          pthread_cond_broadcast(&connection.drained);
+        }
+      } else if (pending != NULL) {
+        result = 0;
+      }
+      pthread_mutex_unlock(&connection.mutex);
+  }
+
+  pthread_mutex_unlock(&connection.send_mutex);
+  pool_free(request_buffer);
+
+  return result;
+}
+
+/// Stores the result of a request, arg points to the int to store it in.
+static void store_result(int result, void* arg) { *(int*)arg = result; }
+
+/// Asks the server for compact CREATE and RESERVE fields, SHOW grids as runs and only the seats that changed since the
+/// grid the client has, the fixed encoding is kept if it refuses.
+/// @return 0 if the server answered, 1 otherwise.
+static int negotiate_encoding(void) {
+  unsigned int encoding = ENCODING_COMPACT | ENCODING_SHOW_RUNS | ENCODING_SHOW_DELTA;
+  int result = 1;
+
+  // Waits for the answer, nothing else may be sent until the encoding is known
+  struct PendingRequest pending = {.callback.done = store_result, .arg = &result};
+  if (send_request('9', &encoding, sizeof(unsigned int), &pending) || ems_flush()) {
+    fprintf(stderr, "Error negotiating the request encoding\n");
+    return 1;
+  }
+
+  if (result == 0) {
+    connection.encoding = encoding;
+  }
+  return 0;
+}
+
+/// Starts the thread that receives every response, once the session id was read.
+/// @return 0 if the thread was started, 1 otherwise.
+static int start_receiving(void) {
+  connection.pending = malloc(connection.window * sizeof(struct PendingRequest));
+  if (connection.pending == NULL) {
+      fprintf(stderr, "Error allocating memory for pending requests\n");
+      return 1;
+  }
+
+  if (pthread_create(&connection.receiver, NULL, receive_thread, NULL) != 0) {
+      fprintf(stderr, "Error creating receive thread\n");
+      return 1;
+  }
+  connection.receiving = 1;
+
+  return negotiate_encoding();
+}
+
+/// Asks the server for a session and starts the receive thread.
+/// @param shm_name Shared memory the server should map for the session, NULL to only use the pipes.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+static int setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path,
+                 char const* shm_name) {
+
+  char request_buffer[1 + PIPE_PATH_MAX * 3];
+  size_t request_size = 1 + PIPE_PATH_MAX * 2;
 
   char buffer_req_path[PIPE_PATH_MAX];
   char buffer_resp_path[PIPE_PATH_MAX];
@@ -26,16 +661,24 @@ int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const*
   memset(buffer_req_path, '\0', sizeof(buffer_req_path));
   memset(buffer_resp_path, '\0', sizeof(buffer_resp_path));
 
-  snprintf(req_pipe_path_, sizeof(req_pipe_path_), "%s", req_pipe_path);
-  snprintf(resp_pipe_path_, sizeof(resp_pipe_path_), "%s", resp_pipe_path);
+  snprintf(connection.req_pipe_path, sizeof(connection.req_pipe_path), "%s", req_pipe_path);
+  snprintf(connection.resp_pipe_path, sizeof(connection.resp_pipe_path), "%s", resp_pipe_path);
 
   snprintf(buffer_req_path, sizeof(buffer_req_path), "../client/%s", req_pipe_path);
   snprintf(buffer_resp_path, sizeof(buffer_resp_path), "../client/%s", resp_pipe_path);
 
-  memcpy(request_buffer, "1", 1);
+  memcpy(request_buffer, shm_name != NULL ? "8" : "1", 1);
   memcpy(request_buffer + 1, buffer_req_path, sizeof(buffer_req_path));
   memcpy(request_buffer + 1 + sizeof(buffer_req_path), buffer_resp_path, sizeof(buffer_resp_path));
 
+  if (shm_name != NULL) {
+    char buffer_shm_name[PIPE_PATH_MAX];
+    memset(buffer_shm_name, '\0', sizeof(buffer_shm_name));
+    snprintf(buffer_shm_name, sizeof(buffer_shm_name), "%s", shm_name);
+    memcpy(request_buffer + request_size, buffer_shm_name, sizeof(buffer_shm_name));
+    request_size += sizeof(buffer_shm_name);
+  }
+
   char full_server_pipe_path[PIPE_PATH_MAX];
   snprintf(full_server_pipe_path, sizeof(full_server_pipe_path), "../server/%s", server_pipe_path);
 
@@ -54,7 +697,7 @@ int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const*
   }
 
   // Write the concatenated string to the server pipe
-  if (write(server_pipe_fd, request_buffer, sizeof(request_buffer)) == -1) {
+  if (write(server_pipe_fd, request_buffer, request_size) == -1) {
       perror("Error writing paths to server pipe");
       close(server_pipe_fd);
       return 1;
@@ -62,344 +705,487 @@ int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const*
 
   close(server_pipe_fd);
 
-  req_pipe_fd = open(req_pipe_path, O_WRONLY);
-  if (req_pipe_fd == -1) {
+  connection.req_pipe_fd = open(req_pipe_path, O_WRONLY);
+  if (connection.req_pipe_fd == -1) {
       perror("Error opening request pipe for writing");
       return 1;
   }
-  resp_pipe_fd = open(resp_pipe_path, O_RDONLY);
-  if (resp_pipe_fd == -1) {
+  connection.resp_pipe_fd = open(resp_pipe_path, O_RDONLY);
+  if (connection.resp_pipe_fd == -1) {
       perror("Error opening server pipe for writing");
       return 1;
   }
 
   //Wait for session id
 
-  ssize_t read_bytes = read(resp_pipe_fd, &session_id, sizeof(session_id));
-  if (read_bytes == -1) {
-      perror("Error reading session id from response pipe");
+  if (read_full(connection.resp_pipe_fd, &connection.session_id, sizeof(connection.session_id))) {
+      fprintf(stderr, "Error reading session id from response pipe\n");
       return 1;
   }
 
-  return 0;
+  // Then whether the server mapped the shared memory, the pipes are used for everything if it did not
+  if (shm_name != NULL) {
+    int shm_status;
+    if (read_full(connection.resp_pipe_fd, &shm_status, sizeof(int))) {
+      fprintf(stderr, "Error reading shared memory status from response pipe\n");
+      return 1;
+    }
+    if (shm_status != 0) {
+      fprintf(stderr, "Server could not map the shared memory, using the pipes\n");
+      munmap(connection.shm, sizeof(struct ShmChannel));
+      connection.shm = NULL;
+    }
+  }
+
+  return start_receiving();
 }
 
-int ems_quit(void) {
-  //TODO: close pipes
+int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path) {
+  return setup(req_pipe_path, resp_pipe_path, server_pipe_path, NULL);
+}
 
-  size_t request_size = 1 + sizeof(unsigned int);
+int ems_setup_shm(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path) {
+  char shm_name[PIPE_PATH_MAX];
+  snprintf(shm_name, sizeof(shm_name), "/ems-%d", getpid());
 
-  char* request_buffer = malloc(request_size);
-  if (request_buffer == NULL) {
-      fprintf(stderr, "Error allocating memory for request_buffer\n");
+  int shm_fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (shm_fd == -1) {
+      perror("Error creating session shared memory");
       return 1;
   }
 
-  memcpy(request_buffer, "2", 1);
-  memcpy(request_buffer + 1, &session_id, sizeof(unsigned int));
-
-  if (write(req_pipe_fd, request_buffer, request_size) == -1) {
-      perror("Error writing quit request to request pipe");
-      free(request_buffer);
+  if (ftruncate(shm_fd, sizeof(struct ShmChannel)) == -1) {
+      perror("Error sizing session shared memory");
+      close(shm_fd);
+      shm_unlink(shm_name);
       return 1;
   }
 
-  // Close request and response pipes
-  if (close(req_pipe_fd) == -1) {
-      perror("Error closing request pipe");
-      free(request_buffer);
+  void* channel = mmap(NULL, sizeof(struct ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  close(shm_fd);
+  if (channel == MAP_FAILED) {
+      perror("Error mapping session shared memory");
+      shm_unlink(shm_name);
       return 1;
   }
 
-  if (close(resp_pipe_fd) == -1) {
-      perror("Error closing response pipe");
-      free(request_buffer);
+  connection.shm = channel;
+  shm_channel_init(connection.shm);
+
+  int result = setup(req_pipe_path, resp_pipe_path, server_pipe_path, shm_name);
+
+  // Once the server answered it has its own mapping, or never will, so the name is not needed anymore
+  shm_unlink(shm_name);
+  return result;
+}
+
+int ems_setup_socket(char const* server_pipe_path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  snprintf(address.sun_path, sizeof(address.sun_path), "../server/%s.sock", server_pipe_path);
+
+  int socket_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (socket_fd == -1) {
+      perror("Error creating socket");
       return 1;
   }
 
-  // Unlink (remove) the named pipes
-  if (unlink(req_pipe_path_) == -1) {
-      perror("Error unlinking request pipe");
-      free(request_buffer);
+  if (connect(socket_fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+      perror("Error connecting to server socket");
+      close(socket_fd);
       return 1;
   }
 
-  if (unlink(resp_pipe_path_) == -1) {
-      perror("Error unlinking response pipe");
-      free(request_buffer);
+  connection.is_socket = 1;
+  connection.req_pipe_fd = socket_fd;
+  connection.resp_pipe_fd = socket_fd;
+
+  //Wait for session id, the server sends it once a session slot is free
+
+  if (read_buffered(&connection.session_id, sizeof(connection.session_id))) {
+      fprintf(stderr, "Error reading session id from socket\n");
       return 1;
   }
 
-  free(request_buffer);
-  return 0;
+  return start_receiving();
 }
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
-  size_t request_size = 1 + sizeof(unsigned int) * 2 + sizeof(size_t) * 2;
+int ems_set_window(size_t window) {
+  if (window == 0 || window > SESSION_MAX_PENDING) {
+    fprintf(stderr, "Invalid window, must be between 1 and %d\n", SESSION_MAX_PENDING);
+    return 1;
+  }
 
-  char* request_buffer = malloc(request_size);
-  if (request_buffer == NULL) {
-      fprintf(stderr, "Error allocating memory for request_buffer\n");
-      return 1;
+  // Holding the send mutex keeps new requests out while the buffer is replaced
+  pthread_mutex_lock(&connection.send_mutex);
+  pthread_mutex_lock(&connection.mutex);
+
+  while (connection.num_pending > 0) {
+    pthread_cond_wait(&connection.drained, &connection.mutex);
   }
 
-  int response;
-  size_t offset_c = 0;
+  int result = 0;
+  struct PendingRequest* pending = realloc(connection.pending, window * sizeof(struct PendingRequest));
+  if (pending == NULL) {
+    fprintf(stderr, "Error allocating memory for pending requests\n");
+    result = 1;
+  } else {
+    connection.pending = pending;
+    connection.pending_head = 0;
+    connection.window = window;
+  }
 
-  memcpy(request_buffer + offset_c, "3", 1);
-  offset_c += 1;
+  pthread_mutex_unlock(&connection.mutex);
+  pthread_mutex_unlock(&connection.send_mutex);
+  return result;
+}
 
-  memcpy(request_buffer + offset_c, &session_id, sizeof(unsigned int));
-  offset_c += sizeof(unsigned int);
+int ems_flush(void) {
+  pthread_mutex_lock(&connection.mutex);
+  while (connection.num_pending > 0) {
+    pthread_cond_wait(&connection.drained, &connection.mutex);
+  }
+  int result = connection.broken;
+  pthread_mutex_unlock(&connection.mutex);
 
-  memcpy(request_buffer + offset_c, &event_id, sizeof(unsigned int));
-  offset_c += sizeof(unsigned int);
+  return result;
+}
 
-  memcpy(request_buffer + offset_c, &num_rows, sizeof(size_t));
-  offset_c += sizeof(size_t);
+int ems_quit(void) {
+  int result = ems_flush();
 
-  memcpy(request_buffer + offset_c, &num_cols, sizeof(size_t));
+  // Quitting has no response, the server closes the response pipe once it is done with the session
+  if (send_request('2', NULL, 0, NULL)) {
+      result = 1;
+  }
 
-  //Writing the request through the request pipe to the server
-  if (write(req_pipe_fd, request_buffer, request_size) == -1) {
-      free(request_buffer);
-      perror("Error writing to request pipe");
+  // Close request and response pipes, a socket is only shut down for writing so the receive thread can finish
+  if (connection.is_socket ? shutdown(connection.req_pipe_fd, SHUT_WR) == -1 : close(connection.req_pipe_fd) == -1) {
+      perror("Error closing request pipe");
       return 1;
   }
 
-  //Read the response from the server through the response pipe
-  ssize_t read_bytes = read(resp_pipe_fd, &response, sizeof(int));
-  if (read_bytes == -1) {
-      free(request_buffer);
-      perror("Error reading from response pipe");
+  if (connection.receiving) {
+    pthread_join(connection.receiver, NULL);
+    connection.receiving = 0;
+  }
+
+  if (connection.shm != NULL) {
+    munmap(connection.shm, sizeof(struct ShmChannel));
+    connection.shm = NULL;
+  }
+
+  free(connection.pending);
+  connection.pending = NULL;
+
+  // Versions belong to this server, a new session starts without grids
+  for (size_t i = 0; i < SHOW_CACHE_SIZE; i++) {
+    pool_free(connection.cache[i].seats);
+    connection.cache[i] = (struct ShowCache){0};
+  }
+
+  if (close(connection.resp_pipe_fd) == -1) {
+      perror("Error closing response pipe");
       return 1;
   }
 
-  if (response == 1) {
-      free(request_buffer);
+  // Sockets leave nothing behind in the file system
+  connection.recv_start = 0;
+  connection.recv_len = 0;
+  connection.encoding = ENCODING_FIXED;
+  connection.notify = NULL;
+  connection.notify_arg = NULL;
+  if (connection.is_socket) {
+    connection.is_socket = 0;
+    return result;
+  }
+
+  // Unlink (remove) the named pipes
+  if (unlink(connection.req_pipe_path) == -1) {
+      perror("Error unlinking request pipe");
       return 1;
+  }
 
+  if (unlink(connection.resp_pipe_path) == -1) {
+      perror("Error unlinking response pipe");
+      return 1;
   }
 
-  free(request_buffer);
-  return 0;
+  return result;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
-    size_t request_size = 1 + sizeof(unsigned int) * 2 + sizeof(size_t) + num_seats * sizeof(size_t) * 2;
+int ems_create_async(unsigned int event_id, size_t num_rows, size_t num_cols, ems_callback callback, void* arg) {
+  char body[WIRE_CREATE_MAX_SIZE];
+  size_t body_size = wire_put_create(body, connection.encoding, event_id, num_rows, num_cols);
 
-    // Allocate a buffer to store the data
-    char* request_buffer = malloc(request_size);
-    if (request_buffer == NULL) {
-        fprintf(stderr, "Error allocating memory for request_buffer\n");
-        return 1;
+  struct PendingRequest pending = {.callback.done = callback, .arg = arg};
+  return send_request('3', body, body_size, &pending);
+}
+
+int ems_reserve_async(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys, ems_callback callback,
+                      void* arg) {
+  char* body = pool_alloc(wire_reserve_max_size(connection.encoding, num_seats));
+  if (body == NULL) {
+      fprintf(stderr, "Error allocating memory for request_buffer\n");
+      return 1;
+  }
+
+  size_t body_size = wire_put_reserve(body, connection.encoding, event_id, num_seats, xs, ys);
+
+  struct PendingRequest pending = {.callback.done = callback, .arg = arg};
+  int result = send_request('4', body, body_size, &pending);
+  pool_free(body);
+  return result;
+}
+
+int ems_show_async(unsigned int event_id, ems_show_callback callback, void* arg) {
+  struct PendingRequest pending = {.callback.show = callback, .arg = arg, .event_id = event_id};
+  char body[sizeof(unsigned int) + sizeof(unsigned long)];
+  size_t body_size = sizeof(unsigned int);
+  memcpy(body, &event_id, sizeof(unsigned int));
+
+  // The cached grid is pinned until the response, which may only carry the changes since its version
+  struct ShowCache* cached = &connection.cache[event_id % SHOW_CACHE_SIZE];
+  if (connection.encoding & ENCODING_SHOW_DELTA) {
+    unsigned long known_version = SHOW_UNKNOWN_VERSION;
+    pthread_mutex_lock(&connection.cache_mutex);
+    if (cached->seats != NULL && cached->event_id == event_id) {
+      known_version = cached->version;
+      cached->pins++;
+      pending.pinned = 1;
     }
+    pthread_mutex_unlock(&connection.cache_mutex);
 
-    // Construct the request_buffer
-    size_t offset = 0;
-    memcpy(request_buffer + offset, "4", 1);
-    offset += 1;
+    memcpy(body + body_size, &known_version, sizeof(unsigned long));
+    body_size += sizeof(unsigned long);
+  }
 
-    memcpy(request_buffer + offset, &session_id, sizeof(unsigned int));
-    offset += sizeof(unsigned int);
+  int result = send_request('5', body, body_size, &pending);
+  if (result != 0 && pending.pinned) {
+    pthread_mutex_lock(&connection.cache_mutex);
+    cached->pins--;
+    pthread_mutex_unlock(&connection.cache_mutex);
+  }
+  return result;
+}
 
-    memcpy(request_buffer + offset, &event_id, sizeof(unsigned int));
-    offset += sizeof(unsigned int);
+int ems_list_events_async(ems_list_callback callback, void* arg) {
+  struct PendingRequest pending = {.callback.list = callback, .arg = arg};
+  return send_request('6', NULL, 0, &pending);
+}
 
-    memcpy(request_buffer + offset, &num_seats, sizeof(size_t));
-    offset += sizeof(size_t);
+void ems_set_notify(ems_notify_callback callback, void* arg) {
+  pthread_mutex_lock(&connection.mutex);
+  connection.notify = callback;
+  connection.notify_arg = arg;
+  pthread_mutex_unlock(&connection.mutex);
+}
 
-    memcpy(request_buffer + offset, xs, num_seats * sizeof(size_t));
-    offset += num_seats * sizeof(size_t);
-    
-    memcpy(request_buffer + offset, ys, num_seats * sizeof(size_t));
+int ems_subscribe_async(size_t num_events, const unsigned int* event_ids, ems_callback callback, void* arg) {
+  // The server drops the session on a request it cannot take
+  if (num_events == 0 || num_events > MAX_SUBSCRIPTIONS) {
+    fprintf(stderr, "Invalid number of events\n");
+    return 1;
+  }
 
-    // Write to the request pipe
-    if (write(req_pipe_fd, request_buffer, request_size) == -1) {
-        perror("Error writing to request pipe");
-        free(request_buffer);  // Free the allocated memory
-        return 1;
-    }
+  char body[sizeof(size_t) + MAX_SUBSCRIPTIONS * sizeof(unsigned int)];
+  memcpy(body, &num_events, sizeof(size_t));
+  memcpy(body + sizeof(size_t), event_ids, num_events * sizeof(unsigned int));
 
-    // Read the response from the response pipe
-    int response;
-    ssize_t read_bytes = read(resp_pipe_fd, &response, sizeof(int));
-    if (read_bytes == -1) {
-        perror("Error reading from response pipe");
-        free(request_buffer);  // Free the allocated memory
-        return 1;
-    }
+  struct PendingRequest pending = {.callback.done = callback, .arg = arg};
+  return send_request('A', body, sizeof(size_t) + num_events * sizeof(unsigned int), &pending);
+}
 
-    // Process the response
-    if (response == 1) {
-        perror("Event couldn't be reserved");
-    }
+struct EmsBatch* ems_batch_create(void) {
+  struct EmsBatch* batch = pool_alloc(sizeof(struct EmsBatch));
+  if (batch == NULL) {
+    fprintf(stderr, "Error allocating memory for batch\n");
+    return NULL;
+  }
 
-    // Free the allocated memory
-    free(request_buffer);
+  batch->num_ops = 0;
+  batch->num_seats = 0;
+  batch->size = 0;
+  return batch;
+}
 
-    return 0;
+void ems_batch_free(struct EmsBatch* batch) { pool_free(batch); }
+
+size_t ems_batch_size(const struct EmsBatch* batch) { return batch->num_ops; }
+
+/// Appends an encoded operation to a batch, if it fits.
+/// @return 0 if the operation was added, 1 if the batch is full.
+static int batch_put(struct EmsBatch* batch, const char* op, size_t size) {
+  if (batch->num_ops == MAX_BATCH_OPS || batch->size + size > MAX_BATCH_SIZE) return 1;
+
+  memcpy(batch->ops + batch->size, op, size);
+  batch->size += size;
+  batch->op_codes[batch->num_ops++] = op[0];
+  return 0;
 }
 
-int ems_show(int out_fd, unsigned int event_id) {
-  //TODO: send show request to the server (through the request pipe) and wait for the response (through the response pipe)
-  size_t request_size = 1 + sizeof(unsigned int) * 2;
+int ems_batch_add_create(struct EmsBatch* batch, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  char op[1 + WIRE_CREATE_MAX_SIZE] = "3";
+  size_t op_size = 1 + wire_put_create(op + 1, connection.encoding, event_id, num_rows, num_cols);
 
-  char* request_buffer = malloc(request_size);
-  if (request_buffer == NULL) {
+  return batch_put(batch, op, op_size);
+}
+
+int ems_batch_add_reserve(struct EmsBatch* batch, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  // The server drops a session sending a malformed batch, so invalid reservations never get in
+  if (num_seats == 0 || num_seats > MAX_RESERVATION_SIZE) return 1;
+  if (batch->num_seats + num_seats > MAX_BATCH_SEATS) return 1;
+
+  char op[1 + WIRE_RESERVE_MAX_SIZE] = "4";
+  size_t op_size = 1 + wire_put_reserve(op + 1, connection.encoding, event_id, num_seats, xs, ys);
+
+  if (batch_put(batch, op, op_size)) return 1;
+  batch->num_seats += num_seats;
+  return 0;
+}
+
+int ems_batch_send_async(struct EmsBatch* batch, ems_batch_callback callback, void* arg) {
+  if (batch->num_ops == 0) return 1;
+
+  // Number of operations and their size, so the server knows the whole request is there before decoding it
+  size_t header_size = 2 * sizeof(size_t);
+  char* body = pool_alloc(header_size + batch->size);
+  if (body == NULL) {
       fprintf(stderr, "Error allocating memory for request_buffer\n");
       return 1;
   }
 
-  size_t offset = 0;
+  memcpy(body, &batch->num_ops, sizeof(size_t));
+  memcpy(body + sizeof(size_t), &batch->size, sizeof(size_t));
+  memcpy(body + header_size, batch->ops, batch->size);
 
-  memcpy(request_buffer + offset, "5", 1);
-  offset += 1;
+  struct PendingRequest pending = {.callback.batch = callback, .arg = arg};
+  int result = send_request('7', body, header_size + batch->size, &pending);
+  pool_free(body);
 
-  memcpy(request_buffer + offset, &session_id, sizeof(unsigned int));
-  offset += sizeof(unsigned int);
+  batch->num_ops = 0;
+  batch->num_seats = 0;
+  batch->size = 0;
+  return result;
+}
 
-  memcpy(request_buffer + offset, &event_id, sizeof(unsigned int));
+/// Reports the failed operations of a batch, arg is a copy of the op codes of the batch.
+static void report_batch(int result, size_t num_ops, const char* statuses, void* arg) {
+  char* op_codes = arg;
 
-  if (write(req_pipe_fd, request_buffer, request_size) == -1) {
-      perror("Error writing to request pipe");
-      free(request_buffer);
-      return 1;
+  if (result != 0) {
+    fprintf(stderr, "Failed to run batch\n");
   }
 
-  int ret_show;
-  ssize_t read_bytes = read(resp_pipe_fd, &ret_show, sizeof(int));
-  if (read_bytes == -1) {
-      perror("Error reading from response pipe");
-      free(request_buffer);
-      return 1;
+  for (size_t i = 0; i < num_ops; i++) {
+    if (statuses[i] != 0) {
+      fprintf(stderr, op_codes[i] == '3' ? "Failed to create event\n" : "Failed to reserve seats\n");
+    }
   }
 
-  if (ret_show == 1) {
-      free(request_buffer);
-      return 1;
-  }
+  pool_free(op_codes);
+}
 
-  size_t num_rows_show, num_cols_show;
-  ssize_t rows_bytes = read(resp_pipe_fd, &num_rows_show, sizeof(size_t));
-  if (rows_bytes == -1) {
-      perror("Error reading from response pipe");
-      free(request_buffer);
+int ems_batch_send(struct EmsBatch* batch) {
+  char* op_codes = pool_alloc(batch->num_ops);
+  if (op_codes == NULL) {
+      fprintf(stderr, "Error allocating memory for batch\n");
       return 1;
   }
+  memcpy(op_codes, batch->op_codes, batch->num_ops);
 
-  ssize_t cols_bytes = read(resp_pipe_fd, &num_cols_show, sizeof(size_t));
-  if (cols_bytes == -1) {
-      perror("Error reading from response pipe");
-      free(request_buffer);
-      return 1;
+  if (ems_batch_send_async(batch, report_batch, op_codes)) {
+    pool_free(op_codes);
+    return 1;
   }
+  return 0;
+}
 
+static void report_create(int result, void* arg) {
+  (void)arg;
+  if (result != 0) fprintf(stderr, "Failed to create event\n");
+}
 
-  unsigned int data_show[num_cols_show * num_rows_show -1];
+static void report_reserve(int result, void* arg) {
+  (void)arg;
+  if (result != 0) fprintf(stderr, "Failed to reserve seats\n");
+}
 
-  ssize_t data_bytes = read(resp_pipe_fd, &data_show, sizeof(unsigned int)* num_cols_show * num_rows_show);
-  if (data_bytes == -1) {
-      perror("Error reading from response pipe");
-      free(request_buffer);
-      return 1;
+static void report_subscribe(int result, void* arg) {
+  (void)arg;
+  if (result != 0) fprintf(stderr, "Failed to subscribe to events\n");
+}
+
+/// Prints the seats of an event, arg is the file descriptor to print to.
+static void print_show(int result, size_t num_rows, size_t num_cols, const unsigned int* seats, void* arg) {
+  int out_fd = (int)(intptr_t)arg;
+
+  if (result != 0) {
+    fprintf(stderr, "Failed to show event\n");
+    return;
   }
 
-  for (size_t i = 0; i < num_rows_show; i++) {
-    for (size_t j = 0; j < num_cols_show; j++) {
-      print_uint(out_fd, data_show[(i * num_rows_show) + j]);
+  for (size_t i = 0; i < num_rows; i++) {
+    for (size_t j = 0; j < num_cols; j++) {
+      if (print_uint(out_fd, seats[i * num_cols + j])) {
+        perror("Error writing to file descriptor");
+        return;
+      }
 
-      if (j < num_cols_show -1) {
+      if (j < num_cols - 1) {
         if (print_str(out_fd, " ")) {
           perror("Error writing to file descriptor");
-          return 1;
+          return;
         }
       }
     }
 
     if (print_str(out_fd, "\n")) {
       perror("Error writing to file descriptor");
-      return 1;
+      return;
     }
   }
-
-  free(request_buffer);
-  return 0;
 }
 
-int ems_list_events(int out_fd) {
-  //TODO: send list request to the server (through the request pipe) and wait for the response (through the response pipe)
-  size_t request_size = 1 + sizeof(unsigned int);
+/// Prints the ids of the events, arg is the file descriptor to print to.
+static void print_list(int result, size_t num_events, const unsigned int* ids, void* arg) {
+  int out_fd = (int)(intptr_t)arg;
 
-  char* request_buffer = malloc(request_size);
-  if (request_buffer == NULL) {
-      fprintf(stderr, "Error allocating memory for request_buffer\n");
-      return 1;
+  if (result != 0) {
+    fprintf(stderr, "Failed to list events\n");
+    return;
   }
 
-  size_t offset = 0;
-
-  memcpy(request_buffer + offset, "6", 1);
-  offset += 1;
-
-  memcpy(request_buffer + offset, &session_id, sizeof(unsigned int));
-  offset += sizeof(unsigned int);
-
-  if (write(req_pipe_fd, request_buffer, request_size) == -1) {
-      perror("Error writing to request pipe");
-      free(request_buffer);
-      return 1;
-  }
-
-  int ret_list;
-  ssize_t read_bytes = read(resp_pipe_fd, &ret_list, sizeof(int));
-  if (read_bytes == -1) {
-      perror("Error reading from response pipe");
-      free(request_buffer);
-      return 1;
-  }
-
-  if(ret_list == 1){
-    free(request_buffer);
-    return 1;
-  }
-
-  size_t num_events;
-  ssize_t num_events_bytes = read(resp_pipe_fd, &num_events, sizeof(size_t));
-  if (num_events_bytes == -1) {
-      perror("Error reading from response pipe");
-      free(request_buffer);
-      return 1;
-  }
-
-  if(num_events == 0){
-
-    const char* no_events_msg = "No events\n";
-    if (write(out_fd, no_events_msg, strlen(no_events_msg)) == -1) {
+  if (num_events == 0) {
+    if (print_str(out_fd, "No events\n")) {
       perror("Error writing 'No events' message to output");
-      free(request_buffer);
-      return 1;
     }
-  }
-
-  unsigned int ids[num_events - 1];
-  ssize_t ids_bytes = read(resp_pipe_fd, &ids, sizeof(unsigned int)* num_events);
-  if (ids_bytes == -1) {
-      perror("Error reading from response pipe");
-      free(request_buffer);
-      return 1;
+    return;
   }
 
   for (size_t i = 0; i < num_events; i++) {
-    char event_msg[50];  // Adjust the size as needed
+    char event_msg[50];
     snprintf(event_msg, sizeof(event_msg), "Event: %u\n", ids[i]);
-    if (write(out_fd, event_msg, strlen(event_msg)) == -1) {
+    if (print_str(out_fd, event_msg)) {
       perror("Error writing event message to output");
-      free(request_buffer);
-      return 1;
+      return;
     }
   }
+}
 
-  free(request_buffer);
-  return 0;
-}
\ No newline at end of file
+int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  return ems_create_async(event_id, num_rows, num_cols, report_create, NULL);
+}
+
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  return ems_reserve_async(event_id, num_seats, xs, ys, report_reserve, NULL);
+}
+
+int ems_show(int out_fd, unsigned int event_id) {
+  return ems_show_async(event_id, print_show, (void*)(intptr_t)out_fd);
+}
+
+int ems_list_events(int out_fd) { return ems_list_events_async(print_list, (void*)(intptr_t)out_fd); }
+
+int ems_subscribe(size_t num_events, const unsigned int* event_ids) {
+  return ems_subscribe_async(num_events, event_ids, report_subscribe, NULL);
+}
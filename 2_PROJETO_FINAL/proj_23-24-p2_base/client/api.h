@@ -3,41 +3,211 @@
 
 #include <stddef.h>
 
+/// Called from the receive thread once the response to a CREATE, RESERVE or SUBSCRIBE arrives.
+/// @note Callbacks run one at a time, in the order the requests were sent, and must not send requests or wait for
+/// them (ems_flush, ems_quit) since no other response is read until they return.
+/// @param result 0 if the operation succeeded, 1 otherwise.
+/// @param arg Argument given with the request.
+typedef void (*ems_callback)(int result, void* arg);
+
+/// Called from the receive thread once the response to a SHOW arrives.
+/// @param result 0 if the seats were received, 1 otherwise.
+/// @param num_rows Number of rows of the event.
+/// @param num_cols Number of columns of the event.
+/// @param seats Reservation id of each seat, row by row. Only valid until the callback returns.
+/// @param arg Argument given with the request.
+typedef void (*ems_show_callback)(int result, size_t num_rows, size_t num_cols, const unsigned int* seats, void* arg);
+
+/// Called from the receive thread once the response to a LIST arrives.
+/// @param result 0 if the ids were received, 1 otherwise.
+/// @param num_events Number of events.
+/// @param ids Id of each event. Only valid until the callback returns.
+/// @param arg Argument given with the request.
+typedef void (*ems_list_callback)(int result, size_t num_events, const unsigned int* ids, void* arg);
+
+/// Called from the receive thread once the response to a batch arrives.
+/// @param result 0 if the batch was run, 1 otherwise.
+/// @param num_ops Number of operations in the batch.
+/// @param statuses 0 for each operation that succeeded, 1 otherwise, in the order they were added.
+/// @param arg Argument given with the request.
+typedef void (*ems_batch_callback)(int result, size_t num_ops, const char* statuses, void* arg);
+
+/// Called from the receive thread when the server pushes a reservation made in a subscribed event.
+/// @param event_id Event the seats were reserved in.
+/// @param reservation_id Id of the reservation. 0 if the client fell behind and reservations of the event were
+/// dropped, it should be shown again to catch up.
+/// @param num_seats Number of seats reserved, 0 when reservation_id is 0.
+/// @param xs Rows of the seats. Only valid until the callback returns.
+/// @param ys Columns of the seats. Only valid until the callback returns.
+/// @param arg Argument given to ems_set_notify().
+typedef void (*ems_notify_callback)(unsigned int event_id, unsigned int reservation_id, size_t num_seats,
+                                    const size_t* xs, const size_t* ys, void* arg);
+
+// CREATE and RESERVE operations collected to be sent as a single request
+struct EmsBatch;
+
 /// Connects to an EMS server.
 /// @param req_pipe_path Path to the name pipe to be created for requests.
 /// @param resp_pipe_path Path to the name pipe to be created for responses.
 /// @param server_pipe_path Path to the name pipe where the server is listening.
+/// @note Starts the thread that receives every response, then agrees with the server on sending CREATE and RESERVE
+/// fields as varints, SHOW grids as runs of equal seats and, for events shown before, only the seats that changed
+/// since, which every setup function does.
 /// @return 0 if the connection was established successfully, 1 otherwise.
 int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path);
 
-/// Disconnects from an EMS server.
+/// Connects to an EMS server, moving requests and responses through shared memory rings instead of the pipes.
+/// @param req_pipe_path Path to the name pipe to be created for requests, only used to wake the server.
+/// @param resp_pipe_path Path to the name pipe to be created for responses, only used to notice the server is gone.
+/// @param server_pipe_path Path to the name pipe where the server is listening.
+/// @note Falls back to the pipes if the server cannot map the shared memory.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+int ems_setup_shm(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path);
+
+/// Connects to an EMS server through the socket it listens on next to its pipe, no pipes are created.
+/// @param server_pipe_path Path to the name pipe where the server is listening, the socket is at this path plus ".sock".
+/// @note Each request is sent as a single datagram.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+int ems_setup_socket(char const* server_pipe_path);
+
+/// Disconnects from an EMS server, after waiting for the requests in flight.
 /// @return 0 in case of success, 1 otherwise.
 int ems_quit(void);
 
-/// Creates a new event with the given id and dimensions.
+/// Sets how many requests may be in flight before a call waits for the oldest response.
+/// @note Operations only send their request and wait for room in the window, their result is handled by the receive
+/// thread. A window of 1 waits for each response before the next request.
+/// @param window Maximum number of requests in flight, at most SESSION_MAX_PENDING.
+/// @return 0 if the window was changed, 1 otherwise.
+int ems_set_window(size_t window);
+
+/// Waits for the responses to every request in flight and for their callbacks.
+/// @return 0 if all of them were received, 1 if the connection failed.
+int ems_flush(void);
+
+/// Sends a request to create an event. Safe to call from several threads.
+/// @param event_id Id of the event to be created.
+/// @param num_rows Number of rows of the event to be created.
+/// @param num_cols Number of columns of the event to be created.
+/// @param callback Called with the result, unless the request could not be sent.
+/// @param arg Passed to the callback.
+/// @return 0 if the request was sent successfully, 1 otherwise.
+int ems_create_async(unsigned int event_id, size_t num_rows, size_t num_cols, ems_callback callback, void* arg);
+
+/// Sends a request to reserve seats. Safe to call from several threads.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @param callback Called with the result, unless the request could not be sent.
+/// @param arg Passed to the callback.
+/// @return 0 if the request was sent successfully, 1 otherwise.
+int ems_reserve_async(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys, ems_callback callback,
+                      void* arg);
+
+/// Sends a request for the seats of an event. Safe to call from several threads.
+/// @param event_id Id of the event.
+/// @param callback Called with the seats, unless the request could not be sent.
+/// @param arg Passed to the callback.
+/// @return 0 if the request was sent successfully, 1 otherwise.
+int ems_show_async(unsigned int event_id, ems_show_callback callback, void* arg);
+
+/// Sends a request for the ids of every event. Safe to call from several threads.
+/// @param callback Called with the ids, unless the request could not be sent.
+/// @param arg Passed to the callback.
+/// @return 0 if the request was sent successfully, 1 otherwise.
+int ems_list_events_async(ems_list_callback callback, void* arg);
+
+/// Sets the function that receives the reservations pushed for subscribed events, until the session ends.
+/// @param callback Called for each reservation pushed, NULL to ignore them.
+/// @param arg Passed to the callback.
+void ems_set_notify(ems_notify_callback callback, void* arg);
+
+/// Subscribes the session to the reservations of some events, which the server pushes as they are made instead of
+/// the client polling with SHOW. Safe to call from several threads.
+/// @note Events already subscribed to are skipped, events that do not exist yet may be subscribed to.
+/// @param num_events Number of events, at most MAX_SUBSCRIPTIONS counting earlier subscriptions.
+/// @param event_ids Ids of the events.
+/// @param callback Called with the result, unless the request could not be sent.
+/// @param arg Passed to the callback.
+/// @return 0 if the request was sent successfully, 1 otherwise.
+int ems_subscribe_async(size_t num_events, const unsigned int* event_ids, ems_callback callback, void* arg);
+
+/// Allocates an empty batch.
+/// @return The batch, NULL if it could not be allocated.
+struct EmsBatch* ems_batch_create(void);
+
+/// Frees a batch.
+/// @param batch Batch to be freed.
+void ems_batch_free(struct EmsBatch* batch);
+
+/// Adds an event creation to a batch.
+/// @param batch Batch to add to.
+/// @param event_id Id of the event to be created.
+/// @param num_rows Number of rows of the event to be created.
+/// @param num_cols Number of columns of the event to be created.
+/// @return 0 if the operation was added, 1 if the batch is full.
+int ems_batch_add_create(struct EmsBatch* batch, unsigned int event_id, size_t num_rows, size_t num_cols);
+
+/// Adds a reservation to a batch.
+/// @param batch Batch to add to.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of seats to reserve, at most MAX_RESERVATION_SIZE.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @return 0 if the operation was added, 1 if the batch is full, holds MAX_BATCH_SEATS seats or the reservation is
+/// invalid.
+int ems_batch_add_reserve(struct EmsBatch* batch, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys);
+
+/// Gets the number of operations in a batch.
+/// @param batch Batch to check.
+/// @return Number of operations added since the batch was created or last sent.
+size_t ems_batch_size(const struct EmsBatch* batch);
+
+/// Sends a batch as one request and empties it. Safe to call from several threads, each with its own batch.
+/// @note The server runs the operations in one pass, the reservations grouped by event, with the same result as running
+/// them in order.
+/// @param batch Batch to send, with at least one operation.
+/// @param callback Called with the status of each operation, unless the request could not be sent.
+/// @param arg Passed to the callback.
+/// @return 0 if the request was sent successfully, 1 otherwise.
+int ems_batch_send_async(struct EmsBatch* batch, ems_batch_callback callback, void* arg);
+
+/// Sends a batch as one request and empties it, reporting each failed operation on stderr.
+/// @param batch Batch to send, with at least one operation.
+/// @return 0 if the request was sent successfully, 1 otherwise.
+int ems_batch_send(struct EmsBatch* batch);
+
+/// Creates a new event with the given id and dimensions, reporting a failure on stderr.
 /// @param event_id Id of the event to be created.
 /// @param num_rows Number of rows of the event to be created.
 /// @param num_cols Number of columns of the event to be created.
-/// @return 0 if the event was created successfully, 1 otherwise.
+/// @return 0 if the request was sent successfully, 1 otherwise.
 int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 
-/// Creates a new reservation for the given event.
+/// Creates a new reservation for the given event, reporting a failure on stderr.
 /// @param event_id Id of the event to create a reservation for.
 /// @param num_seats Number of seats to reserve.
 /// @param xs Array of rows of the seats to reserve.
 /// @param ys Array of columns of the seats to reserve.
-/// @return 0 if the reservation was created successfully, 1 otherwise.
+/// @return 0 if the request was sent successfully, 1 otherwise.
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys);
 
 /// Prints the given event to the given file.
 /// @param out_fd File descriptor to print the event to.
 /// @param event_id Id of the event to print.
-/// @return 0 if the event was printed successfully, 1 otherwise.
+/// @return 0 if the request was sent successfully, 1 otherwise.
 int ems_show(int out_fd, unsigned int event_id);
 
 /// Prints all the events to the given file.
 /// @param out_fd File descriptor to print the events to.
-/// @return 0 if the events were printed successfully, 1 otherwise.
+/// @return 0 if the request was sent successfully, 1 otherwise.
 int ems_list_events(int out_fd);
 
+/// Subscribes the session to the reservations of some events, reporting a failure on stderr.
+/// @param num_events Number of events.
+/// @param event_ids Ids of the events.
+/// @return 0 if the request was sent successfully, 1 otherwise.
+int ems_subscribe(size_t num_events, const unsigned int* event_ids);
+
 #endif  // CLIENT_API_H
@@ -1,5 +1,6 @@
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -7,18 +8,58 @@
 #include "../common/constants.h"
 #include "parser.h"
 
+/// Sends the CREATE and RESERVE lines collected so far, before a line that depends on them.
+/// @param batch Batch of the job file.
+static void send_batch(struct EmsBatch* batch) {
+  if (ems_batch_size(batch) > 0 && ems_batch_send(batch)) {
+    fprintf(stderr, "Failed to send batch\n");
+  }
+}
+
 int main(int argc, char* argv[]) {
-  if (argc < 5) {
-    fprintf(stderr, "Usage: %s <request pipe path> <response pipe path> <server pipe path> <.jobs file path>\n",
+  if (argc < 5 || argc > 7) {
+    fprintf(stderr,
+            "Usage: %s <request pipe path> <response pipe path> <server pipe path> <.jobs file path> [window] "
+            "[fifo|shm|socket]\n",
             argv[0]);
     return 1;
   }
 
-  if (ems_setup(argv[1], argv[2], argv[3])) {
+  unsigned long int window = CLIENT_WINDOW;
+  if (argc >= 6) {
+    char* endptr;
+    window = strtoul(argv[5], &endptr, 10);
+
+    if (*endptr != '\0' || window == 0 || window > SESSION_MAX_PENDING) {
+      fprintf(stderr, "Invalid window, must be between 1 and %d\n", SESSION_MAX_PENDING);
+      return 1;
+    }
+  }
+
+  const char* transport = argc == 7 ? argv[6] : "fifo";
+  int setup_result;
+  if (strcmp(transport, "fifo") == 0) {
+    setup_result = ems_setup(argv[1], argv[2], argv[3]);
+  } else if (strcmp(transport, "shm") == 0) {
+    setup_result = ems_setup_shm(argv[1], argv[2], argv[3]);
+  } else if (strcmp(transport, "socket") == 0) {
+    setup_result = ems_setup_socket(argv[3]);
+  } else {
+    fprintf(stderr, "Invalid transport, must be fifo, shm or socket\n");
+    return 1;
+  }
+
+  if (setup_result) {
     fprintf(stderr, "Failed to set up EMS\n");
     return 1;
   }
 
+  // Stream the job file, keeping up to window requests in flight
+  if (ems_set_window(window)) {
+    fprintf(stderr, "Failed to set the request window\n");
+    return 1;
+  }
+
   const char* dot = strrchr(argv[4], '.');
   if (dot == NULL || dot == argv[4] || strlen(dot) != 5 || strcmp(dot, ".jobs") ||
       strlen(argv[4]) > MAX_JOB_FILE_NAME_SIZE) {
@@ -42,6 +83,13 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  // Consecutive CREATE and RESERVE lines travel together in one batch request
+  struct EmsBatch* batch = ems_batch_create();
+  if (batch == NULL) {
+    fprintf(stderr, "Failed to create batch\n");
+    return 1;
+  }
+
   while (1) {
     unsigned int event_id;
     size_t num_rows, num_columns, num_coords;
@@ -55,7 +103,11 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
-        if (ems_create(event_id, num_rows, num_columns)) fprintf(stderr, "Failed to create event\n");
+        // A full batch is sent and the line starts the next one
+        if (ems_batch_add_create(batch, event_id, num_rows, num_columns)) {
+          send_batch(batch);
+          if (ems_batch_add_create(batch, event_id, num_rows, num_columns)) fprintf(stderr, "Failed to create event\n");
+        }
         break;
 
       case CMD_RESERVE:
@@ -66,7 +118,10 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
-        if (ems_reserve(event_id, num_coords, xs, ys)) fprintf(stderr, "Failed to reserve seats\n");
+        if (ems_batch_add_reserve(batch, event_id, num_coords, xs, ys)) {
+          send_batch(batch);
+          if (ems_batch_add_reserve(batch, event_id, num_coords, xs, ys)) fprintf(stderr, "Failed to reserve seats\n");
+        }
         break;
 
       case CMD_SHOW:
@@ -75,10 +130,12 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
+        send_batch(batch);
         if (ems_show(out_fd, event_id)) fprintf(stderr, "Failed to show event\n");
         break;
 
       case CMD_LIST_EVENTS:
+        send_batch(batch);
         if (ems_list_events(out_fd)) fprintf(stderr, "Failed to list events\n");
         break;
 
@@ -88,6 +145,10 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
+        // Waiting only makes sense once everything before it has been served
+        send_batch(batch);
+        if (ems_flush()) fprintf(stderr, "Failed to receive responses\n");
+
         if (delay > 0) {
             printf("Waiting...\n");
             sleep(delay);
@@ -114,9 +175,12 @@ int main(int argc, char* argv[]) {
         break;
 
       case EOC:
+        // Quitting waits for the responses still in flight, which may print to out_fd
+        send_batch(batch);
+        ems_batch_free(batch);
+        ems_quit();
         close(in_fd);
         close(out_fd);
-        ems_quit();
         return 0;
     }
   }
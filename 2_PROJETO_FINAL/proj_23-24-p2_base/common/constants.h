@@ -1,6 +1,34 @@
 #define MAX_RESERVATION_SIZE 256
 #define STATE_ACCESS_DELAY_US 500000  // 500ms
 #define MAX_JOB_FILE_NAME_SIZE 256
-#define MAX_SESSION_COUNT 2
+#define MAX_SESSION_COUNT 1024  // Default for the server max_sessions argument
+#define WORKER_THREAD_COUNT 4    // Default for the server workers argument
 #define PIPE_PATH_MAX 40
-#define MAX_BUFFER_SIZE 2
+#define MAX_BUFFER_SIZE 2  // Default for the server buffer_size argument, rounded up to a power of two
+#define EVENT_ROW_STRIPES 64  // Upper bound on the row locks of a single event
+#define BATCH_RUN_STRIPES 16   // Row locks a batch holds at once for the reservations of one event
+#define SNAPSHOT_ATTEMPTS 4   // Lock-free copies a SHOW tries before it locks every row of the event
+#define MAX_BATCH_SIZE 32736       // Bytes of operations in a batch request, fits in a frame with its header
+#define MAX_FRAME_SIZE 32768       // Largest request frame, length prefix included, and receive buffer of a session
+#define MAX_BATCH_SEATS 2048       // Seats of all the reservations in a batch, bounds a decoded batch
+#define ENCODING_FIXED 0u      // CREATE and RESERVE fields as unsigned int and size_t, full SHOW grids: how a session starts
+#define ENCODING_COMPACT 1u    // Flag: the same fields as varints, the seats as runs of consecutive columns in a row
+#define ENCODING_SHOW_RUNS 2u  // Flag: SHOW grids as runs of seats with the same reservation id
+#define ENCODING_SHOW_DELTA 4u  // Flag: SHOW sends the last version seen, only changed seats come back
+#define ENCODING_KNOWN (ENCODING_COMPACT | ENCODING_SHOW_RUNS | ENCODING_SHOW_DELTA)  // Every flag the server knows
+#define SHOW_UNKNOWN_VERSION ((unsigned long)-1)  // Version a SHOW sends when the client has no grid of the event
+#define SHOW_UNCHANGED 0  // Delta SHOW response: the grid is the one the client has
+#define SHOW_CHANGES 1    // Delta SHOW response: ranges of seats that changed, then their new values
+#define SHOW_FULL 2       // Delta SHOW response: the whole grid
+#define EVENT_CHANGE_LOG_SIZE 256  // Ranges of booked seats an event remembers for delta SHOWs
+#define SHOW_CACHE_SIZE 64         // Grids a client keeps to apply delta SHOWs to, by event id
+#define MAX_SUBSCRIPTIONS 64       // Events a session can subscribe to
+#define SUBSCRIBER_QUEUE_SIZE 64   // Notifications queued for a session before they are coalesced
+#define SPLICE_MIN_SIZE 32768      // Smallest grid, in bytes, a SHOW hands to a response pipe without copying it
+#define SPLICE_BUFFERS 4           // Splice buffers each worker keeps while pipes still hold the pages of others
+#define SESSION_MAX_PENDING 64     // Requests queued in a session before the server stops reading it
+#define REACTOR_BATCH_SIZE 64      // Readiness events handled per epoll_wait
+#define CLIENT_OPEN_TIMEOUT_MS 1000  // How long the connector waits for a client to open its response pipe
+#define CLIENT_WINDOW 32           // Default requests a client keeps in flight, at most SESSION_MAX_PENDING
+#define SHM_RING_SIZE (1u << 20)   // Bytes of each shared memory ring of a session, a power of two
+#define SOCKET_MESSAGE_SIZE 65536  // Largest datagram on a socket session, longer responses are split
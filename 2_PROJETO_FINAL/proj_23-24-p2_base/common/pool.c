@@ -0,0 +1,180 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// In front of every buffer, as large as malloc's alignment so the buffer keeps it
+union PoolHeader {
+  struct {
+    size_t size_class;       // Class the buffer belongs to, POOL_NUM_CLASSES if it is too large to be kept
+    union PoolHeader* next;  // Next free buffer of the same class while it is kept
+  } block;
+  max_align_t align;
+};
+
+// Free buffers of one size class
+struct PoolList {
+  union PoolHeader* head;
+  size_t count;
+};
+
+static _Thread_local struct PoolList caches[POOL_NUM_CLASSES];
+static _Thread_local size_t thread_hits = 0;
+static _Thread_local size_t thread_misses = 0;
+
+// Shared by every thread, buffers freed by one thread reach the others through it
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct PoolList depot[POOL_NUM_CLASSES];
+
+static atomic_size_t total_hits;
+static atomic_size_t total_misses;
+
+/// Gets the number of bytes of the buffers of a class.
+static size_t class_size(size_t size_class) { return (size_t)POOL_MIN_SIZE << size_class; }
+
+/// Gets the number of buffers of a class a thread keeps.
+static size_t class_limit(size_t size_class) {
+  size_t limit = POOL_CACHE_BYTES / class_size(size_class);
+  if (limit == 0) return 1;
+  return limit < POOL_CACHE_BUFFERS ? limit : POOL_CACHE_BUFFERS;
+}
+
+/// Gets the smallest class whose buffers fit a size, POOL_NUM_CLASSES if none does.
+static size_t class_of(size_t size) {
+  size_t size_class = 0;
+  while (size_class < POOL_NUM_CLASSES && class_size(size_class) < size) {
+    size_class++;
+  }
+  return size_class;
+}
+
+/// Adds the counts of the calling thread to the totals.
+static void flush_stats(void) {
+  atomic_fetch_add_explicit(&total_hits, thread_hits, memory_order_relaxed);
+  atomic_fetch_add_explicit(&total_misses, thread_misses, memory_order_relaxed);
+  thread_hits = 0;
+  thread_misses = 0;
+}
+
+/// Counts an allocation of the calling thread.
+/// @param hit Whether a kept buffer served it.
+static void count(int hit) {
+  if (hit) {
+    thread_hits++;
+  } else {
+    thread_misses++;
+  }
+
+  if (thread_hits + thread_misses >= POOL_STATS_INTERVAL) flush_stats();
+}
+
+/// Moves up to half a thread cache of buffers from the depot to the cache of the calling thread.
+static void refill(size_t size_class) {
+  struct PoolList* cache = &caches[size_class];
+  struct PoolList* shared = &depot[size_class];
+  size_t wanted = (class_limit(size_class) + 1) / 2;
+
+  pthread_mutex_lock(&depot_lock);
+  while (wanted-- > 0 && shared->head != NULL) {
+    union PoolHeader* header = shared->head;
+    shared->head = header->block.next;
+    shared->count--;
+
+    header->block.next = cache->head;
+    cache->head = header;
+    cache->count++;
+  }
+  pthread_mutex_unlock(&depot_lock);
+}
+
+/// Moves buffers from the cache of the calling thread to the depot, freeing those that do not fit.
+/// @param num_buffers Number of buffers to move, at most the number cached.
+static void spill(size_t size_class, size_t num_buffers) {
+  struct PoolList* cache = &caches[size_class];
+  struct PoolList* shared = &depot[size_class];
+  size_t depot_limit = POOL_DEPOT_FACTOR * class_limit(size_class);
+
+  pthread_mutex_lock(&depot_lock);
+  while (num_buffers > 0 && shared->count < depot_limit) {
+    union PoolHeader* header = cache->head;
+    cache->head = header->block.next;
+    cache->count--;
+    num_buffers--;
+
+    header->block.next = shared->head;
+    shared->head = header;
+    shared->count++;
+  }
+  pthread_mutex_unlock(&depot_lock);
+
+  // The depot is full, the rest goes back to malloc without holding it
+  while (num_buffers-- > 0) {
+    union PoolHeader* header = cache->head;
+    cache->head = header->block.next;
+    cache->count--;
+    free(header);
+  }
+}
+
+void *pool_alloc(size_t size) {
+  size_t size_class = class_of(size);
+
+  if (size_class == POOL_NUM_CLASSES) {
+    union PoolHeader* header = malloc(sizeof(union PoolHeader) + size);
+    if (header == NULL) return NULL;
+
+    count(0);
+    header->block.size_class = size_class;
+    return header + 1;
+  }
+
+  struct PoolList* cache = &caches[size_class];
+  if (cache->head == NULL) refill(size_class);
+
+  union PoolHeader* header = cache->head;
+  if (header != NULL) {
+    cache->head = header->block.next;
+    cache->count--;
+    count(1);
+  } else {
+    header = malloc(sizeof(union PoolHeader) + class_size(size_class));
+    if (header == NULL) return NULL;
+    count(0);
+  }
+
+  header->block.size_class = size_class;
+  return header + 1;
+}
+
+void pool_free(void *buffer) {
+  if (buffer == NULL) return;
+
+  union PoolHeader* header = (union PoolHeader*)buffer - 1;
+  size_t size_class = header->block.size_class;
+
+  if (size_class == POOL_NUM_CLASSES) {
+    free(header);
+    return;
+  }
+
+  struct PoolList* cache = &caches[size_class];
+  if (cache->count == class_limit(size_class)) spill(size_class, (cache->count + 1) / 2);
+
+  header->block.next = cache->head;
+  cache->head = header;
+  cache->count++;
+}
+
+void pool_drain(void) {
+  for (size_t size_class = 0; size_class < POOL_NUM_CLASSES; size_class++) {
+    spill(size_class, caches[size_class].count);
+  }
+  flush_stats();
+}
+
+void pool_stats(size_t *hits, size_t *misses) {
+  flush_stats();
+  *hits = atomic_load_explicit(&total_hits, memory_order_relaxed);
+  *misses = atomic_load_explicit(&total_misses, memory_order_relaxed);
+}
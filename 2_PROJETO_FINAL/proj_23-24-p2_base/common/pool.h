@@ -0,0 +1,34 @@
+#ifndef COMMON_POOL_H
+#define COMMON_POOL_H
+
+#include <stddef.h>
+
+#define POOL_MIN_SIZE 64             // Bytes of the smallest size class, each class doubles the previous one
+#define POOL_NUM_CLASSES 16          // Size classes, larger buffers always come from malloc
+#define POOL_CACHE_BYTES (1u << 20)  // Bytes of one class a thread keeps for itself, at least one buffer
+#define POOL_CACHE_BUFFERS 64        // Most buffers of one class a thread keeps for itself
+#define POOL_DEPOT_FACTOR 4          // Thread caches worth of buffers the shared depot keeps per class
+#define POOL_STATS_INTERVAL 256      // Allocations a thread counts before adding them to the totals
+
+/// Gets a buffer from the size class that fits it, reusing one freed earlier when the calling thread or the shared
+/// depot has one.
+/// @note Buffers move between threads through the depot, so one thread may free what another allocated.
+/// @param size Number of bytes needed.
+/// @return Buffer aligned like malloc's, to be released with pool_free(). NULL on failure.
+void *pool_alloc(size_t size);
+
+/// Gives a buffer back to the cache of the calling thread, handing half of it to the depot when it is full.
+/// @param buffer Buffer from pool_alloc(), or NULL.
+void pool_free(void *buffer);
+
+/// Hands every buffer the calling thread keeps to the depot, freeing those that do not fit.
+/// @note Meant for threads about to exit, which would otherwise leak their cache.
+void pool_drain(void);
+
+/// Gets the number of allocations served with a reused buffer and the number that needed malloc.
+/// @note Other threads add their counts every POOL_STATS_INTERVAL allocations, the totals may lag behind.
+/// @param hits Pointer to store the allocations served from a cache in.
+/// @param misses Pointer to store the allocations that called malloc in.
+void pool_stats(size_t *hits, size_t *misses);
+
+#endif  // COMMON_POOL_H
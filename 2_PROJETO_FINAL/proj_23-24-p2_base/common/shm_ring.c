@@ -0,0 +1,148 @@
+#define _GNU_SOURCE  // syscall()
+
+#include "shm_ring.h"
+
+#include <linux/futex.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// How long a side sleeps before checking again that its peer is still there
+#define SHM_WAIT_TIMEOUT_NS 50000000L
+
+// The words live in memory shared between processes, so the futex calls cannot be the private ones
+static void futex_wait(atomic_uint* word, unsigned int expected) {
+  struct timespec timeout = {0, SHM_WAIT_TIMEOUT_NS};
+  syscall(SYS_futex, (unsigned int*)word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word) { syscall(SYS_futex, (unsigned int*)word, FUTEX_WAKE, 1, NULL, NULL, 0); }
+
+/// Checks whether the other end of a pipe was closed.
+static int peer_gone(int peer_fd) {
+  struct pollfd pfd = {.fd = peer_fd, .events = POLLOUT};
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL));
+}
+
+static void ring_init(struct ShmRing* ring) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->producer_waiting, 0);
+  atomic_init(&ring->consumer_waiting, 0);
+}
+
+void shm_channel_init(struct ShmChannel* channel) {
+  ring_init(&channel->requests);
+  ring_init(&channel->responses);
+  atomic_init(&channel->closed, 0);
+
+  // The server only reads a new session once its request pipe has something, so the first request rings
+  atomic_store(&channel->requests.consumer_waiting, 1);
+}
+
+size_t shm_ring_used(struct ShmRing* ring) {
+  return atomic_load(&ring->tail) - atomic_load(&ring->head);
+}
+
+size_t shm_ring_put(struct ShmRing* ring, const void* buffer, size_t size) {
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+  size_t room = SHM_RING_SIZE - (tail - head);
+  size_t count = size < room ? size : room;
+  size_t start = tail % SHM_RING_SIZE;
+  size_t first = count < SHM_RING_SIZE - start ? count : SHM_RING_SIZE - start;
+
+  memcpy(ring->data + start, buffer, first);
+  memcpy(ring->data, (const char*)buffer + first, count - first);
+
+  atomic_store_explicit(&ring->tail, tail + (unsigned int)count, memory_order_release);
+  return count;
+}
+
+size_t shm_ring_get(struct ShmRing* ring, void* buffer, size_t size) {
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  size_t used = tail - head;
+  size_t count = size < used ? size : used;
+  size_t start = head % SHM_RING_SIZE;
+  size_t first = count < SHM_RING_SIZE - start ? count : SHM_RING_SIZE - start;
+
+  memcpy(buffer, ring->data + start, first);
+  memcpy((char*)buffer + first, ring->data, count - first);
+
+  if (count > 0) {
+    atomic_store_explicit(&ring->head, head + (unsigned int)count, memory_order_release);
+
+    // Pairs with the producer announcing itself before checking for room, see shm_ring_send()
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->producer_waiting, memory_order_relaxed) &&
+        atomic_exchange(&ring->producer_waiting, 0)) {
+      futex_wake(&ring->head);
+    }
+  }
+
+  return count;
+}
+
+// Both sides announce they are waiting before sampling the futex word and checking the ring again, while the other
+// side moves the word before checking for waiters: either the waiter sees the new bytes or the other side sees it.
+
+int shm_ring_send(struct ShmRing* ring, const void* buffer, size_t size, int peer_fd, int doorbell) {
+  size_t done = 0;
+
+  while (1) {
+    size_t count = shm_ring_put(ring, (const char*)buffer + done, size - done);
+    done += count;
+
+    if (count > 0) {
+      atomic_thread_fence(memory_order_seq_cst);
+      if (atomic_load_explicit(&ring->consumer_waiting, memory_order_relaxed) &&
+          atomic_exchange(&ring->consumer_waiting, 0)) {
+        if (doorbell) {
+          char bell = 0;
+          if (write(peer_fd, &bell, 1) == -1) return 1;
+        } else {
+          futex_wake(&ring->tail);
+        }
+      }
+    }
+
+    if (done == size) return 0;
+
+    atomic_store(&ring->producer_waiting, 1);
+    unsigned int head = atomic_load(&ring->head);
+    if (atomic_load(&ring->tail) - head < SHM_RING_SIZE) continue;
+
+    if (peer_gone(peer_fd)) return 1;
+    futex_wait(&ring->head, head);
+  }
+}
+
+int shm_ring_recv(struct ShmRing* ring, void* buffer, size_t size, int peer_fd, atomic_uint* closed) {
+  size_t done = 0;
+
+  while (1) {
+    done += shm_ring_get(ring, (char*)buffer + done, size - done);
+    if (done == size) return 0;
+
+    atomic_store(&ring->consumer_waiting, 1);
+    unsigned int tail = atomic_load(&ring->tail);
+    if (tail != atomic_load(&ring->head)) continue;
+
+    // Only given up on once everything written before closing was read
+    if (atomic_load(closed) || peer_gone(peer_fd)) {
+      if (atomic_load(&ring->tail) == tail) return 1;
+      continue;
+    }
+    futex_wait(&ring->tail, tail);
+  }
+}
+
+void shm_channel_close(struct ShmChannel* channel) {
+  atomic_store(&channel->closed, 1);
+  futex_wake(&channel->responses.tail);
+}
@@ -0,0 +1,73 @@
+#ifndef COMMON_SHM_RING_H
+#define COMMON_SHM_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "constants.h"
+
+#define SHM_CACHE_LINE_SIZE 64
+
+// Single-producer single-consumer byte ring living in memory shared by the client and the server.
+// head and tail count bytes and wrap around, they double as the futex words each side sleeps on.
+struct ShmRing {
+  _Alignas(SHM_CACHE_LINE_SIZE) atomic_uint head;  // Bytes consumed
+  atomic_uint producer_waiting;                     // Producer is waiting for head to move
+  _Alignas(SHM_CACHE_LINE_SIZE) atomic_uint tail;  // Bytes produced
+  atomic_uint consumer_waiting;                     // Consumer is waiting for tail to move
+  _Alignas(SHM_CACHE_LINE_SIZE) char data[SHM_RING_SIZE];
+};
+
+// Shared memory object of a session, created by the client and mapped by the server
+struct ShmChannel {
+  struct ShmRing requests;   // Client to server
+  struct ShmRing responses;  // Server to client
+  atomic_uint closed;        // Set by the server once it is done with the session
+};
+
+/// Initializes both rings of a new channel.
+/// @param channel Channel to be initialized.
+void shm_channel_init(struct ShmChannel* channel);
+
+/// Gets the number of bytes waiting to be consumed.
+/// @param ring Ring to check.
+/// @return Number of bytes in the ring.
+size_t shm_ring_used(struct ShmRing* ring);
+
+/// Copies as many bytes as fit into a ring, without waiting or waking the consumer.
+/// @param ring Ring to write to.
+/// @param buffer Bytes to write.
+/// @param size Number of bytes to write.
+/// @return Number of bytes written.
+size_t shm_ring_put(struct ShmRing* ring, const void* buffer, size_t size);
+
+/// Copies as many bytes as are available out of a ring, waking the producer if it is waiting for room.
+/// @param ring Ring to read from.
+/// @param buffer Buffer to read to.
+/// @param size Maximum number of bytes to read.
+/// @return Number of bytes read.
+size_t shm_ring_get(struct ShmRing* ring, void* buffer, size_t size);
+
+/// Writes every byte to a ring, sleeping while it is full.
+/// @param ring Ring to write to.
+/// @param buffer Bytes to write.
+/// @param size Number of bytes to write.
+/// @param peer_fd Pipe to the other side, checked while waiting so a dead peer is noticed.
+/// @param doorbell If set, a waiting consumer is woken by writing a byte to peer_fd instead of through the futex.
+/// @return 0 if every byte was written, 1 if the peer is gone.
+int shm_ring_send(struct ShmRing* ring, const void* buffer, size_t size, int peer_fd, int doorbell);
+
+/// Reads exactly size bytes from a ring, sleeping while it is empty.
+/// @param ring Ring to read from.
+/// @param buffer Buffer to read to.
+/// @param size Number of bytes to read.
+/// @param peer_fd Pipe to the other side, checked while waiting so a dead peer is noticed.
+/// @param closed Flag the producer sets when it will not write anymore.
+/// @return 0 if every byte was read, 1 if the ring was closed or the peer is gone.
+int shm_ring_recv(struct ShmRing* ring, void* buffer, size_t size, int peer_fd, atomic_uint* closed);
+
+/// Tells the other side of the channel the server will not use it anymore.
+/// @param channel Channel to be closed.
+void shm_channel_close(struct ShmChannel* channel);
+
+#endif  // COMMON_SHM_RING_H
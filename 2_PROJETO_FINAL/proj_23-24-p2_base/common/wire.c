@@ -0,0 +1,218 @@
+#include "wire.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+size_t varint_put(char *buffer, size_t value) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    buffer[size++] = (char)((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  buffer[size++] = (char)value;
+  return size;
+}
+
+int varint_get(const char *buffer, size_t len, size_t *offset, size_t *value) {
+  size_t result = 0;
+
+  for (unsigned int shift = 0; shift < 7 * VARINT_MAX_SIZE; shift += 7) {
+    if (*offset == len) return 1;
+
+    unsigned char byte = (unsigned char)buffer[(*offset)++];
+
+    // The last byte only has room for the top bit of a size_t
+    if (shift == 7 * (VARINT_MAX_SIZE - 1) && byte > 1) return 1;
+
+    result |= (size_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/// Copies a fixed size field, the counterpart of a varint in ENCODING_FIXED.
+static int take(const char *buffer, size_t len, size_t *offset, void *field, size_t size) {
+  if (len - *offset < size) return 1;
+
+  memcpy(field, buffer + *offset, size);
+  *offset += size;
+  return 0;
+}
+
+/// Reads a size, as a size_t or a varint depending on the encoding.
+static int get_size(const char *buffer, size_t len, size_t *offset, unsigned int encoding, size_t *value) {
+  if (encoding & ENCODING_COMPACT) return varint_get(buffer, len, offset, value);
+  return take(buffer, len, offset, value, sizeof(size_t));
+}
+
+/// Reads an event id, as an unsigned int or a varint depending on the encoding.
+static int get_event_id(const char *buffer, size_t len, size_t *offset, unsigned int encoding,
+                        unsigned int *event_id) {
+  if (!(encoding & ENCODING_COMPACT)) return take(buffer, len, offset, event_id, sizeof(unsigned int));
+
+  size_t value;
+  if (varint_get(buffer, len, offset, &value) || value > UINT_MAX) return 1;
+  *event_id = (unsigned int)value;
+  return 0;
+}
+
+/// Writes a size, as a size_t or a varint depending on the encoding.
+static size_t put_size(char *buffer, unsigned int encoding, size_t value) {
+  if (encoding & ENCODING_COMPACT) return varint_put(buffer, value);
+
+  memcpy(buffer, &value, sizeof(size_t));
+  return sizeof(size_t);
+}
+
+/// Writes an event id, as an unsigned int or a varint depending on the encoding.
+static size_t put_event_id(char *buffer, unsigned int encoding, unsigned int event_id) {
+  if (encoding & ENCODING_COMPACT) return varint_put(buffer, event_id);
+
+  memcpy(buffer, &event_id, sizeof(unsigned int));
+  return sizeof(unsigned int);
+}
+
+size_t wire_reserve_max_size(unsigned int encoding, size_t num_seats) {
+  // Row, column and length of one run per seat at worst
+  if (encoding & ENCODING_COMPACT) return (2 + 3 * num_seats) * VARINT_MAX_SIZE;
+  return sizeof(unsigned int) + sizeof(size_t) + 2 * num_seats * sizeof(size_t);
+}
+
+size_t wire_put_create(char *buffer, unsigned int encoding, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  size_t size = put_event_id(buffer, encoding, event_id);
+  size += put_size(buffer + size, encoding, num_rows);
+  size += put_size(buffer + size, encoding, num_cols);
+  return size;
+}
+
+size_t wire_put_reserve(char *buffer, unsigned int encoding, unsigned int event_id, size_t num_seats, const size_t *xs,
+                        const size_t *ys) {
+  size_t size = put_event_id(buffer, encoding, event_id);
+  size += put_size(buffer + size, encoding, num_seats);
+
+  if (!(encoding & ENCODING_COMPACT)) {
+    memcpy(buffer + size, xs, num_seats * sizeof(size_t));
+    size += num_seats * sizeof(size_t);
+    memcpy(buffer + size, ys, num_seats * sizeof(size_t));
+    size += num_seats * sizeof(size_t);
+    return size;
+  }
+
+  // Row, first column and number of seats of each run, a row booked left to right takes a single run
+  size_t i = 0;
+  while (i < num_seats) {
+    size_t run = 1;
+    while (i + run < num_seats && xs[i + run] == xs[i] && ys[i + run] == ys[i] + run) {
+      run++;
+    }
+
+    size += varint_put(buffer + size, xs[i]);
+    size += varint_put(buffer + size, ys[i]);
+    size += varint_put(buffer + size, run);
+    i += run;
+  }
+
+  return size;
+}
+
+int wire_get_create(const char *buffer, size_t len, size_t *offset, unsigned int encoding, unsigned int *event_id,
+                    size_t *num_rows, size_t *num_cols) {
+  return get_event_id(buffer, len, offset, encoding, event_id) || get_size(buffer, len, offset, encoding, num_rows) ||
+         get_size(buffer, len, offset, encoding, num_cols);
+}
+
+int wire_get_reserve(const char *buffer, size_t len, size_t *offset, unsigned int encoding, unsigned int *event_id,
+                     size_t *num_seats) {
+  return get_event_id(buffer, len, offset, encoding, event_id) || get_size(buffer, len, offset, encoding, num_seats);
+}
+
+int wire_get_seats(const char *buffer, size_t len, size_t *offset, unsigned int encoding, size_t num_seats,
+                   size_t *xs, size_t *ys) {
+  if (!(encoding & ENCODING_COMPACT)) {
+    if (len - *offset < 2 * num_seats * sizeof(size_t)) return 1;
+
+    if (xs != NULL) {
+      take(buffer, len, offset, xs, num_seats * sizeof(size_t));
+      take(buffer, len, offset, ys, num_seats * sizeof(size_t));
+    } else {
+      *offset += 2 * num_seats * sizeof(size_t);
+    }
+    return 0;
+  }
+
+  size_t seats = 0;
+  while (seats < num_seats) {
+    size_t x, y, run;
+    if (varint_get(buffer, len, offset, &x) || varint_get(buffer, len, offset, &y) ||
+        varint_get(buffer, len, offset, &run)) {
+      return 1;
+    }
+
+    // Runs must be within the seats announced and not wrap around
+    if (run == 0 || run > num_seats - seats || run - 1 > SIZE_MAX - y) return 1;
+
+    if (xs != NULL) {
+      for (size_t k = 0; k < run; k++) {
+        xs[seats + k] = x;
+        ys[seats + k] = y + k;
+      }
+    }
+    seats += run;
+  }
+
+  return 0;
+}
+
+/// Gets the number of bytes varint_put() writes for a value.
+static size_t varint_size(size_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+size_t wire_put_seat_runs(char *buffer, const unsigned int *seats, size_t num_seats) {
+  size_t size = 0;
+  size_t i = 0;
+  while (i < num_seats) {
+    size_t run = 1;
+    while (i + run < num_seats && seats[i + run] == seats[i]) {
+      run++;
+    }
+
+    if (buffer != NULL) {
+      size += varint_put(buffer + size, run);
+      size += varint_put(buffer + size, seats[i]);
+    } else {
+      size += varint_size(run) + varint_size(seats[i]);
+    }
+    i += run;
+  }
+
+  return size;
+}
+
+int wire_get_seat_runs(const char *buffer, size_t len, unsigned int *seats, size_t num_seats) {
+  size_t offset = 0;
+  size_t filled = 0;
+  while (filled < num_seats) {
+    size_t run, id;
+    if (varint_get(buffer, len, &offset, &run) || varint_get(buffer, len, &offset, &id)) return 1;
+    if (run == 0 || run > num_seats - filled || id > UINT_MAX) return 1;
+
+    for (size_t k = 0; k < run; k++) {
+      seats[filled + k] = (unsigned int)id;
+    }
+    filled += run;
+  }
+
+  // Nothing may follow the last run
+  return offset != len;
+}
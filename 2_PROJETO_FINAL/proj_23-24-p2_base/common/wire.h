@@ -0,0 +1,79 @@
+#ifndef COMMON_WIRE_H
+#define COMMON_WIRE_H
+
+#include <stddef.h>
+
+#include "constants.h"
+
+#define VARINT_MAX_SIZE 10                          // Bytes of the longest varint, a size_t of 64 bits
+#define WIRE_CREATE_MAX_SIZE (3 * VARINT_MAX_SIZE)  // Bytes of the longest encoded CREATE fields
+#define WIRE_RESERVE_MAX_SIZE ((2 + 3 * MAX_RESERVATION_SIZE) * VARINT_MAX_SIZE)  // Same for a valid RESERVE
+
+/// Writes a value as an unsigned LEB128 varint, seven bits per byte with the high bit set on all but the last.
+/// @param buffer Buffer with room for VARINT_MAX_SIZE bytes.
+/// @param value Value to write.
+/// @return Number of bytes written.
+size_t varint_put(char *buffer, size_t value);
+
+/// Reads an unsigned LEB128 varint.
+/// @param buffer Bytes to read from.
+/// @param len Number of bytes in the buffer.
+/// @param offset Position of the varint, moved past it.
+/// @param value Pointer to store the value in.
+/// @return 0 if the value was read, 1 if it is cut short or does not fit in a size_t.
+int varint_get(const char *buffer, size_t len, size_t *offset, size_t *value);
+
+/// Gets the number of bytes the fields of a reservation can take at most.
+/// @param encoding Encoding flags, only ENCODING_COMPACT changes the fields.
+/// @param num_seats Number of seats of the reservation.
+/// @return Maximum number of bytes.
+size_t wire_reserve_max_size(unsigned int encoding, size_t num_seats);
+
+/// Encodes the fields of a CREATE: event id, number of rows and number of columns.
+/// @param buffer Buffer with room for WIRE_CREATE_MAX_SIZE bytes.
+/// @return Number of bytes written.
+size_t wire_put_create(char *buffer, unsigned int encoding, unsigned int event_id, size_t num_rows, size_t num_cols);
+
+/// Encodes the fields of a RESERVE: event id, number of seats and the seats.
+/// @note With ENCODING_COMPACT the seats go as runs of consecutive columns in a row, in the order they were given.
+/// @param buffer Buffer with room for wire_reserve_max_size() bytes.
+/// @return Number of bytes written.
+size_t wire_put_reserve(char *buffer, unsigned int encoding, unsigned int event_id, size_t num_seats, const size_t *xs,
+                        const size_t *ys);
+
+/// Decodes the fields of a CREATE.
+/// @param buffer Bytes to read from.
+/// @param len Number of bytes in the buffer.
+/// @param offset Position of the fields, moved past them.
+/// @return 0 if the fields were read, 1 if they are malformed.
+int wire_get_create(const char *buffer, size_t len, size_t *offset, unsigned int encoding, unsigned int *event_id,
+                    size_t *num_rows, size_t *num_cols);
+
+/// Decodes the event id and number of seats of a RESERVE, which come before the seats.
+/// @return 0 if the fields were read, 1 if they are malformed.
+int wire_get_reserve(const char *buffer, size_t len, size_t *offset, unsigned int encoding, unsigned int *event_id,
+                     size_t *num_seats);
+
+/// Decodes the seats of a RESERVE.
+/// @param xs Where the rows are stored, or NULL to only check and skip the seats.
+/// @param ys Where the columns are stored, ignored if xs is NULL.
+/// @return 0 if exactly num_seats seats were read, 1 if they are malformed.
+int wire_get_seats(const char *buffer, size_t len, size_t *offset, unsigned int encoding, size_t num_seats,
+                   size_t *xs, size_t *ys);
+
+/// Encodes the seats of a SHOW as runs of equal reservation ids, the length and the id of each run as varints.
+/// @note Rows are not marked, a run may go on into the next row.
+/// @param buffer Where the runs are written, or NULL to only count their bytes.
+/// @param seats Seats of the event, row after row.
+/// @param num_seats Number of seats of the event.
+/// @return Number of bytes of the runs.
+size_t wire_put_seat_runs(char *buffer, const unsigned int *seats, size_t num_seats);
+
+/// Decodes the seats of a SHOW sent as runs.
+/// @param buffer Runs to read.
+/// @param len Number of bytes of the runs.
+/// @param seats Where the num_seats seats are stored.
+/// @return 0 if the runs cover exactly num_seats seats and nothing else, 1 if they are malformed.
+int wire_get_seat_runs(const char *buffer, size_t len, unsigned int *seats, size_t num_seats);
+
+#endif  // COMMON_WIRE_H
@@ -3,6 +3,15 @@
 #include <pthread.h>
 #include <stdlib.h>
 
+#include "../common/pool.h"
+
+/// Maps an event id to its bucket in the index (Fibonacci hashing).
+/// @param event_id Event id.
+/// @return Bucket index.
+static size_t bucket_of(unsigned int event_id) {
+  return (size_t)((event_id * 2654435769u) >> (32 - EVENT_INDEX_BITS));
+}
+
 struct EventList* create_list() {
   struct EventList* list = (struct EventList*)malloc(sizeof(struct EventList));
   if (!list) return NULL;
@@ -10,33 +19,115 @@ struct EventList* create_list() {
     free(list);
     return NULL;
   }
+  if (pthread_mutex_init(&list->slab_lock, NULL) != 0) {
+    pthread_rwlock_destroy(&list->rwl);
+    free(list);
+    return NULL;
+  }
   list->head = NULL;
   list->tail = NULL;
+  list->slabs = NULL;
+  list->spare = NULL;
+  for (size_t i = 0; i < EVENT_INDEX_SIZE; i++) {
+    atomic_init(&list->index[i], NULL);
+  }
   return list;
 }
 
-int append_to_list(struct EventList* list, struct Event* event) {
-  if (!list) return 1;
+static struct Event* find_in_bucket(struct ListNode* current, unsigned int event_id) {
+  while (current) {
+    if (current->event->id == event_id) {
+      return current->event;
+    }
+    current = current->hash_next;
+  }
+
+  return NULL;
+}
+
+/// Takes a node for a new event, from the spare ones or the current slab.
+/// @return The node, NULL if a new slab was needed and could not be allocated.
+static struct ListNode* take_node(struct EventList* list) {
+  pthread_mutex_lock(&list->slab_lock);
+
+  struct ListNode* node = list->spare;
+  if (node != NULL) {
+    list->spare = node->next;
+    pthread_mutex_unlock(&list->slab_lock);
+    return node;
+  }
 
-  struct ListNode* new_node = (struct ListNode*)malloc(sizeof(struct ListNode));
-  if (!new_node) return 1;
+  if (list->slabs == NULL || list->slabs->used == EVENT_NODE_SLAB_SIZE) {
+    struct NodeSlab* slab = malloc(sizeof(struct NodeSlab));
+    if (slab == NULL) {
+      pthread_mutex_unlock(&list->slab_lock);
+      return NULL;
+    }
+    slab->next = list->slabs;
+    slab->used = 0;
+    list->slabs = slab;
+  }
+
+  node = &list->slabs->nodes[list->slabs->used++];
+  pthread_mutex_unlock(&list->slab_lock);
+  return node;
+}
+
+/// Keeps a node that was never published for the next insert.
+static void give_back_node(struct EventList* list, struct ListNode* node) {
+  pthread_mutex_lock(&list->slab_lock);
+  node->next = list->spare;
+  list->spare = node;
+  pthread_mutex_unlock(&list->slab_lock);
+}
+
+struct Event* insert_if_absent(struct EventList* list, struct Event* event) {
+  if (!list || !event) return NULL;
+
+  struct ListNode* new_node = take_node(list);
+  if (!new_node) return NULL;
 
   new_node->event = event;
   new_node->next = NULL;
 
+  _Atomic(struct ListNode*)* bucket = &list->index[bucket_of(event->id)];
+
+  // Inserts take turns under the write lock, so an event is in the index exactly when it is in the list, and events
+  // are found in the order LIST shows them. Lookups still read the bucket without it
+  pthread_rwlock_wrlock(&list->rwl);
+
+  struct ListNode* head = atomic_load_explicit(bucket, memory_order_relaxed);
+  struct Event* existing = find_in_bucket(head, event->id);
+  if (existing != NULL) {
+    pthread_rwlock_unlock(&list->rwl);
+    give_back_node(list, new_node);
+    return existing;
+  }
+
   if (list->head == NULL) {
     list->head = new_node;
-    list->tail = new_node;
   } else {
     list->tail->next = new_node;
-    list->tail = new_node;
   }
+  list->tail = new_node;
+
+  new_node->hash_next = head;
+  atomic_store_explicit(bucket, new_node, memory_order_release);
 
-  return 0;
+  pthread_rwlock_unlock(&list->rwl);
+  return event;
 }
 
-static void free_event(struct Event* event) {
+void free_event(struct Event* event) {
   if (!event) return;
+  for (size_t i = 0; i < event->num_stripes; i++) {
+    pthread_mutex_destroy(&event->row_locks[i]);
+  }
+  free(event->row_locks);
+  pthread_mutex_destroy(&event->log_lock);
+  pool_free((void*)(atomic_load(&event->rendered[0]) & ~RENDERED_BORROWS));
+  pool_free((void*)(atomic_load(&event->rendered[1]) & ~RENDERED_BORROWS));
+  free(event->changes);
   free(event->data);
   free(event);
 }
@@ -46,29 +137,24 @@ void free_list(struct EventList* list) {
 
   struct ListNode* current = list->head;
   while (current) {
-    struct ListNode* temp = current;
+    free_event(current->event);
     current = current->next;
+  }
 
-    free_event(temp->event);
-    free(temp);
+  // The nodes go with their slabs
+  while (list->slabs) {
+    struct NodeSlab* slab = list->slabs;
+    list->slabs = slab->next;
+    free(slab);
   }
 
+  pthread_mutex_destroy(&list->slab_lock);
+  pthread_rwlock_destroy(&list->rwl);
   free(list);
 }
 
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to) {
-  if (!list || !from || !to) return NULL;
-  struct ListNode* current = from;
-
-  while (1) {
-    if (current->event->id == event_id) {
-      return current->event;
-    }
-
-    if (current == to) {
-      return NULL;
-    }
+struct Event* get_event(struct EventList* list, unsigned int event_id) {
+  if (!list) return NULL;
 
-    current = current->next;
-  }
+  return find_in_bucket(atomic_load_explicit(&list->index[bucket_of(event_id)], memory_order_acquire), event_id);
 }
@@ -2,40 +2,99 @@
 #define SERVER_EVENT_LIST_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#define EVENT_INDEX_BITS 14
+#define EVENT_INDEX_SIZE (1u << EVENT_INDEX_BITS)  // Number of buckets in the event index
+#define EVENT_NODE_SLAB_SIZE 64                      // List nodes allocated at once
+
+// Seats booked by one write, consecutive in row-major order
+struct SeatRange {
+  unsigned long write;  // Value write_seq took when the write began
+  size_t first;         // Index of the first seat, (row - 1) * cols + col - 1
+  size_t count;         // Number of seats
+};
+
+#define RENDERED_BORROWS ((uintptr_t)15)  // Low bits of a rendered payload pointer, pool buffers are 16 aligned
+_Static_assert(_Alignof(max_align_t) > RENDERED_BORROWS, "pool buffers leave no room for the borrow count");
+
+// Payload of a SHOW sent as a whole grid, shared by every SHOW of the same version and never modified once built
+struct ShowBlob {
+  atomic_uint refs;       // References held by the event and by the SHOWs sending it, freed with the last one
+  unsigned long version;  // Version of the event the grid corresponds to
+  size_t size;            // Number of bytes of data
+  _Alignas(size_t) char data[];  // Seats of the grid, or their runs
+};
 
 struct Event {
-  unsigned int id;            /// Event id
-  unsigned int reservations;  /// Number of reservations for the event.
+  unsigned int id;           /// Event id
+  atomic_uint reservations;  /// Number of reservations for the event.
 
   size_t cols;  /// Number of columns.
   size_t rows;  /// Number of rows.
 
-  unsigned int* data;     /// Array of size rows * cols with the reservations for each seat.
-  pthread_mutex_t mutex;  // Mutex to protect the event
+  atomic_uint* data;           /// Array of size rows * cols with the reservations for each seat, read while written
+  size_t num_stripes;          // Number of row locks, at most EVENT_ROW_STRIPES
+  pthread_mutex_t* row_locks;  // Lock i protects every row r with (r - 1) % num_stripes == i
+
+  atomic_ulong write_seq;  // Bumped by a reservation right before it writes its seats
+  atomic_ulong version;    // Bumped by a reservation once its seats are written, equals write_seq when idle
+
+  pthread_mutex_t log_lock;    // Protects the change log below
+  struct SeatRange* changes;   // Last EVENT_CHANGE_LOG_SIZE ranges booked, used as a circular buffer
+  size_t num_changes;          // Ranges ever logged, the next one goes to num_changes % EVENT_CHANGE_LOG_SIZE
+  unsigned long log_floor;     // Latest write that lost a range to the circular buffer, older versions get full grids
+
+  // Last full grid sent as the seats themselves [0] or as runs [1], 0 if none. The RENDERED_BORROWS bits count the
+  // SHOWs that read the pointer and have not taken their reference yet
+  atomic_uintptr_t rendered[2];
 };
 
 struct ListNode {
   struct Event* event;
-  struct ListNode* next;
+  struct ListNode* next;       // Next node in creation order
+  struct ListNode* hash_next;  // Next node in the same index bucket, immutable once published
+};
+
+// Nodes handed out in order, events are never removed so a slab lives as long as its list
+struct NodeSlab {
+  struct NodeSlab* next;  // Slab filled before this one
+  size_t used;            // Nodes handed out
+  struct ListNode nodes[EVENT_NODE_SLAB_SIZE];
 };
 
 // Linked list structure
 struct EventList {
   struct ListNode* head;  // Head of the list
   struct ListNode* tail;  // Tail of the list
-  pthread_rwlock_t rwl;   // Mutex to protect the list
+  pthread_rwlock_t rwl;   // Protects head, tail and next pointers, held for writing while an event is published
+
+  pthread_mutex_t slab_lock;  // Protects the slabs and spare nodes
+  struct NodeSlab* slabs;     // Slab nodes are taken from, then the full ones
+  struct ListNode* spare;     // Nodes of inserts that found the id taken, linked by next
+
+  _Atomic(struct ListNode*) index[EVENT_INDEX_SIZE];  // Lock-free hash index keyed by event id
 };
 
 /// Creates a new event list.
 /// @return Newly created event list, NULL on failure
 struct EventList* create_list();
 
-/// Appends a new node to the list.
+/// Inserts an event in the list unless an event with the same id is already there.
+/// @note Lookups never block: the event is published in the index with a single store, made under the write lock
+/// together with the append to the creation order list, so the index never holds an event LIST does not show.
 /// @param list Event list to be modified.
-/// @param data Event to be stored in the new node.
-/// @return 0 if the node was appended successfully, 1 otherwise.
-int append_to_list(struct EventList* list, struct Event* data);
+/// @param event Event to be inserted.
+/// @return The event stored under that id: `event` itself if it was inserted, the previously stored event if the id
+/// was taken, NULL on failure.
+struct Event* insert_if_absent(struct EventList* list, struct Event* event);
+
+/// Frees an event, its seats, its row locks and its rendered SHOW payloads.
+/// @note No SHOW may still hold a reference to the payloads.
+/// @param event Event to be freed, must not be in a list.
+void free_event(struct Event* event);
 
 /// Removes a node from the list.
 /// @param list Event list to be modified.
@@ -45,9 +104,7 @@ void free_list(struct EventList* list);
 /// Retrieves an event in the list.
 /// @param list Event list to be searched
 /// @param event_id Event id.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to);
+struct Event* get_event(struct EventList* list, unsigned int event_id);
 
 #endif  // SERVER_EVENT_LIST_H
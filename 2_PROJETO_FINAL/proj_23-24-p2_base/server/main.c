@@ -7,229 +7,673 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "../common/constants.h"
 #include "../common/io.h"
+#include "../common/pool.h"
 #include "operations.h"
-
-//Mutex and condition variables
-pthread_mutex_t buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t buffer_not_empty = PTHREAD_COND_INITIALIZER;
-pthread_cond_t buffer_not_full = PTHREAD_COND_INITIALIZER;
+#include "ring.h"
+#include "session.h"
 
 //Clients struct
 struct ClientData {
   char req_pipe_path[PIPE_PATH_MAX];
   char resp_pipe_path[PIPE_PATH_MAX];
+  char shm_name[PIPE_PATH_MAX];  // Shared memory the client asked to use, empty for pipes only
+  int sock_fd;                   // Accepted socket connection, -1 for clients using pipes
 };
 
-//Client Node
-struct ClientNode{
-  struct ClientData client;
-  struct ClientNode* next;
-};
+// Connection buffer, clients waiting for a session slot are stored by value
+static struct Ring buffer;
+
+volatile sig_atomic_t sig;
+
+static int epoll_fd;  // Request pipes of every open session, watched by the reactor
+
+// Shared memory sessions whose backlog drained, the reactor reads them again since no doorbell may come for the
+// requests already in their ring
+static struct Session* resumed_head = NULL;
+static pthread_mutex_t resumed_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int wake_fd;  // Event fd in the reactor's epoll set, signalled when resumed_head is set
 
-//Buffer struct, implemented as a linked list
-struct Buffer{
-  struct ClientNode* head;
-  struct ClientNode* tail;
-  size_t size;
+// Where an operation sends its response, the request id goes in front of it
+struct Reply {
+  struct Session* session;
+  unsigned int request_id;
 };
 
-struct Buffer buffer = {NULL, NULL, 0};
+/// Sends a response preceded by the id of the request it answers, in a single write.
+/// @note Matches ems_sender, destination is a struct Reply.
+static int send_reply(void* destination, const struct iovec* iov, int iovcnt) {
+  struct Reply* reply = destination;
 
-int sig;
+  struct iovec reply_iov[iovcnt + 1];
+  reply_iov[0] = (struct iovec){&reply->request_id, sizeof(unsigned int)};
+  memcpy(reply_iov + 1, iov, (size_t)iovcnt * sizeof(struct iovec));
 
-void *worker_thread(void *arg) {
+  return session_send(reply->session, reply_iov, iovcnt + 1);
+}
+
+/// Lends the splice buffer of the session a response goes to.
+/// @note Matches ems_lender, destination is a struct Reply.
+static void* lend_seat_buffer(void* destination, size_t size) {
+  struct Reply* reply = destination;
+  return session_splice_buffer(reply->session, size);
+}
+
+/// Writes a response that fits in a single int, preceded by the id of the request it answers.
+/// @param session Session to answer.
+/// @param request_id Id of the request being answered.
+/// @param status Result of the operation.
+/// @return 0 if the response was written, 1 otherwise.
+static int write_response(struct Session* session, unsigned int request_id, int status) {
+  struct Reply reply = {session, request_id};
+  struct iovec iov = {&status, sizeof(int)};
+  return send_reply(&reply, &iov, 1);
+}
+
+/// Executes a decoded request and writes its response.
+/// @note Responses start with the request id, so a client may keep several requests in flight and match the answers,
+/// which are always written in the order the requests arrived.
+/// @param session Session the request belongs to.
+/// @param request Request to be executed.
+/// @return 0 if the session is still open, 1 if it ended.
+static int execute_request(struct Session* session, struct Request* request) {
+  switch(request->op_code){
+
+    case '2':
+      return 1;
+
+    case '3': {
+      int result = ems_create(request->event_id, request->num_rows, request->num_cols);
+      write_response(session, request->request_id, result);
+      break;
+    }
+
+    case '4': {
+      int reserve_result = ems_reserve(request->event_id, request->num_seats, request->xs, request->ys);
+      write_response(session, request->request_id, reserve_result);
+      break;
+    }
+
+    case '5': {
+      // ems_show sends the status and the seats itself, and nothing if it fails
+      struct Reply reply = {session, request->request_id};
+      if (ems_show(send_reply, &reply, request->event_id, request->encoding, request->known_version) == 1) {
+        write_response(session, request->request_id, 1);
+      }
+
+      break;
+    }
+
+    case '7': {
+      // Status, number of operations and one status byte per operation
+      char* statuses = pool_alloc(request->num_ops);
+      if (statuses == NULL || ems_batch(request->num_ops, request->ops, statuses)) {
+        pool_free(statuses);
+        write_response(session, request->request_id, 1);
+        break;
+      }
+
+      struct Reply reply = {session, request->request_id};
+      int status = 0;
+      struct iovec iov[] = {{&status, sizeof(int)}, {&request->num_ops, sizeof(size_t)}, {statuses, request->num_ops}};
+      send_reply(&reply, iov, 3);
+      pool_free(statuses);
+      break;
+    }
+
+    case '9':
+      // Already switched by the reactor, only unknown flags are refused
+      write_response(session, request->request_id, (request->encoding & ~ENCODING_KNOWN) == 0 ? 0 : 1);
+      break;
+
+    case '6': {
+      struct Reply reply = {session, request->request_id};
+      if (ems_list_events(send_reply, &reply) == 1) {
+        write_response(session, request->request_id, 1);
+      }
+
+      break;
+    }
+
+    case 'A':
+      write_response(session, request->request_id,
+                     session_subscribe(session, request->encoding, request->num_events, request->coords));
+      break;
+
+    case 'N': {
+      // Pushed with request id 0: reservation id, then the size and fields of a RESERVE in the subscribed encoding
+      char* body = pool_alloc(wire_reserve_max_size(request->encoding, request->num_seats));
+      if (body == NULL) {
+        fprintf(stderr, "Error allocating memory for notification\n");
+        break;
+      }
+
+      size_t body_size = wire_put_reserve(body, request->encoding, request->event_id, request->num_seats, request->xs,
+                                          request->ys);
+      struct Reply reply = {session, 0};
+      struct iovec iov[] = {
+          {&request->reservation_id, sizeof(unsigned int)}, {&body_size, sizeof(size_t)}, {body, body_size}};
+      send_reply(&reply, iov, 3);
+      pool_free(body);
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/// Asks the reactor to wake up again once the session has more input.
+static void rearm_session(struct Session* session) {
+  struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = session};
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->req_fd, &event) == -1) {
+    perror("Error rearming session");
+  }
+}
+
+/// Stops reading a session and queues a quit request behind the ones already decoded.
+static void close_session_input(struct Session* session) {
+  session->closing = 1;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->req_fd, NULL);
+
+  struct Request* quit = pool_alloc(sizeof(struct Request));
+  if (quit == NULL) {
+    fprintf(stderr, "Error allocating memory for quit request, session %u is never released\n", session->id);
+    return;
+  }
+  quit->op_code = '2';
+  session_push(session, quit);
+}
+
+/// Decodes and queues every complete request in the receive buffer of a session.
+/// @param session Session with new bytes in its receive buffer.
+/// @return 0 if the session is still being read, 1 if its input was closed.
+static int decode_requests(struct Session* session) {
+  size_t offset = 0;
+  while (1) {
+    struct Request* request;
+    ssize_t consumed =
+        decode_request(session->recv_buffer + offset, session->recv_len - offset, session->encoding, &request);
+
+    if (consumed == 0) {
+      break;
+    }
+
+    if (consumed == -1) {
+      fprintf(stderr, "Malformed request, closing session %u\n", session->id);
+      close_session_input(session);
+      return 1;
+    }
+
+    offset += (size_t)consumed;
+
+    if (request->op_code == '2') {
+      pool_free(request);
+      close_session_input(session);
+      return 1;
+    }
+
+    // Applies to the requests after this one, which are decoded next
+    if (request->op_code == '9' && (request->encoding & ~ENCODING_KNOWN) == 0) {
+      session->encoding = request->encoding;
+    }
+
+    session_push(session, request);
+  }
+
+  // Keep the partial request at the start of the buffer
+  memmove(session->recv_buffer, session->recv_buffer + offset, session->recv_len - offset);
+  session->recv_len -= offset;
+  return 0;
+}
+
+/// Reads the requests a shared memory session wrote to its ring.
+/// @note The request pipe only carries doorbells, rung by the client when the reactor asked for one before sleeping.
+/// @param session Session whose doorbell rang, or that was resumed.
+static void receive_shm_requests(struct Session* session) {
+  struct ShmRing* ring = &session->shm->requests;
+  int ended = 0;
 
+  char doorbells[64];
+  while (1) {
+    ssize_t bytes_read = read(session->req_fd, doorbells, sizeof(doorbells));
+    if (bytes_read > 0) continue;
+    if (bytes_read == -1 && errno == EINTR) continue;
+    if (bytes_read == -1 && errno == EAGAIN) break;
+
+    // Client closed its end, whatever it wrote to the ring before is still served
+    ended = 1;
+    break;
+  }
+
+  while (1) {
+    session->recv_len += shm_ring_get(ring, session->recv_buffer + session->recv_len,
+                                      MAX_FRAME_SIZE - session->recv_len);
+
+    if (decode_requests(session)) return;
+
+    // Resumed through resumed_head once the backlog drains
+    if (!session_wants_input(session)) return;
+
+    if (shm_ring_used(ring) > 0) continue;
+
+    if (ended) {
+      close_session_input(session);
+      return;
+    }
+
+    // Ask for a doorbell, then check again in case the client wrote before seeing the request for one
+    atomic_store(&ring->consumer_waiting, 1);
+    if (shm_ring_used(ring) == 0 || atomic_exchange(&ring->consumer_waiting, 0) == 0) break;
+  }
+
+  rearm_session(session);
+}
+
+/// Reads the datagrams a socket session has sent, each one carrying whole requests.
+/// @param session Session whose socket is readable.
+static void receive_socket_requests(struct Session* session) {
+  while (1) {
+    size_t room = MAX_FRAME_SIZE - session->recv_len;
+    ssize_t bytes_read = recv(session->req_fd, session->recv_buffer + session->recv_len, room,
+                              MSG_DONTWAIT | MSG_TRUNC);
+
+    // Client closed its end, with or without quitting
+    if (bytes_read == 0) {
+      close_session_input(session);
+      return;
+    }
+
+    if (bytes_read == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) break;
+
+      perror("Error reading from session socket");
+      close_session_input(session);
+      return;
+    }
+
+    // The rest of a datagram that did not fit is lost, no request is that long
+    if ((size_t)bytes_read > room) {
+      fprintf(stderr, "Request too long, closing session %u\n", session->id);
+      close_session_input(session);
+      return;
+    }
+
+    session->recv_len += (size_t)bytes_read;
+
+    if (decode_requests(session)) return;
+
+    if (!session_wants_input(session)) return;
+  }
+
+  rearm_session(session);
+}
+
+/// Reads whatever a session has sent and queues every complete request.
+/// @param session Session whose request pipe is readable.
+static void receive_requests(struct Session* session) {
+  if (session->shm != NULL) {
+    receive_shm_requests(session);
+    return;
+  }
+
+  if (session->is_socket) {
+    receive_socket_requests(session);
+    return;
+  }
+
+  ssize_t bytes_read = read(session->req_fd, session->recv_buffer + session->recv_len,
+                            MAX_FRAME_SIZE - session->recv_len);
+
+  // Client closed its end, with or without quitting
+  if (bytes_read == 0) {
+    close_session_input(session);
+    return;
+  }
+
+  if (bytes_read == -1) {
+    if (errno == EAGAIN || errno == EINTR) {
+      rearm_session(session);
+      return;
+    }
+
+    perror("erros ao ler do pipe da solicitacao");
+    close_session_input(session);
+    return;
+  }
+
+  session->recv_len += (size_t)bytes_read;
+
+  if (decode_requests(session)) return;
+
+  if (session_wants_input(session)) {
+    rearm_session(session);
+  }
+}
+
+/// Starts reading a session again once its backlog drained.
+/// @param session Session that was paused.
+static void resume_session(struct Session* session) {
+  if (session->shm == NULL) {
+    rearm_session(session);
+    return;
+  }
+
+  pthread_mutex_lock(&resumed_mutex);
+  session->next_resumed = resumed_head;
+  resumed_head = session;
+  pthread_mutex_unlock(&resumed_mutex);
+
+  if (write(wake_fd, &(uint64_t){1}, sizeof(uint64_t)) == -1) {
+    perror("Error waking the reactor");
+  }
+}
+
+/// Makes sure the reactor does not read a session that is about to be released.
+/// @param session Session that ended.
+static void forget_resumed(struct Session* session) {
+  pthread_mutex_lock(&resumed_mutex);
+  for (struct Session** current = &resumed_head; *current != NULL; current = &(*current)->next_resumed) {
+    if (*current == session) {
+      *current = session->next_resumed;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&resumed_mutex);
+}
+
+/// Reads again every session resumed by the workers.
+static void receive_resumed(void) {
+  uint64_t count;
+  if (read(wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+    perror("Error reading reactor wake ups");
+  }
+
+  // Served under the mutex, so a worker forgetting a session it is about to release waits for the reactor to be done
+  pthread_mutex_lock(&resumed_mutex);
+  while (resumed_head != NULL) {
+    struct Session* session = resumed_head;
+    resumed_head = session->next_resumed;
+
+    if (!session->closing) {
+      receive_requests(session);
+    }
+  }
+  pthread_mutex_unlock(&resumed_mutex);
+}
+
+static void block_sigusr1() {
   sigset_t mask;
   sigemptyset(&mask);
   sigaddset(&mask, SIGUSR1);
   pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
 
-  unsigned int session_id = *(unsigned int *)arg;
-  free(arg);
+/// Maps the shared memory a client created for its session.
+/// @param name Name of the shared memory object.
+/// @return The channel, NULL if it could not be mapped.
+static struct ShmChannel* map_channel(const char* name) {
+  int shm_fd = shm_open(name, O_RDWR, 0);
+  if (shm_fd == -1) {
+    perror("Error opening session shared memory");
+    return NULL;
+  }
 
-  while (1) {
+  struct stat shm_stat;
+  if (fstat(shm_fd, &shm_stat) == -1 || (size_t)shm_stat.st_size < sizeof(struct ShmChannel)) {
+    fprintf(stderr, "Session shared memory is too small\n");
+    close(shm_fd);
+    return NULL;
+  }
+
+  void* channel = mmap(NULL, sizeof(struct ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  close(shm_fd);
+  if (channel == MAP_FAILED) {
+    perror("Error mapping session shared memory");
+    return NULL;
+  }
+
+  return channel;
+}
 
-    pthread_mutex_lock(&buffer_mutex);
+/// Opens the response pipe of a client without waiting on it forever.
+/// @note A non blocking open fails until the client opens its end, which it does right after its request pipe, so it
+/// is retried every millisecond until CLIENT_OPEN_TIMEOUT_MS pass.
+/// @param path Path of the response pipe.
+/// @return The write end of the pipe, -1 on error or if the client never opened it.
+static int open_response_pipe(const char* path) {
+  struct timespec retry = {0, 1000000};
+
+  for (unsigned int waited = 0; waited < CLIENT_OPEN_TIMEOUT_MS; waited++) {
+    int fd = open(path, O_WRONLY | O_NONBLOCK);
+    if (fd != -1) {
+      // Only the reads are non blocking, responses must not be cut short by a full pipe
+      int flags = fcntl(fd, F_GETFL);
+      if (flags == -1 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        perror("Error setting response pipe blocking");
+        close(fd);
+        return -1;
+      }
+      return fd;
+    }
 
-    //Wait for queue to be not empty
-    while(buffer.head == NULL){
-      pthread_cond_wait(&buffer_not_empty, &buffer_mutex);
+    if (errno != ENXIO && errno != EINTR) {
+      return -1;
     }
+    nanosleep(&retry, NULL);
+  }
 
-    struct ClientNode* current_client = buffer.head;
-    buffer.head = current_client->next;
-    if (buffer.head == NULL) {
-        buffer.tail = NULL;
+  errno = ETIMEDOUT;
+  return -1;
+}
+
+/// Opens the pipes of a client, or takes over its socket.
+/// @param session Session being opened.
+/// @param client Client taken from the connection buffer.
+/// @return 0 if the session can be read by the reactor, 1 otherwise.
+static int open_client(struct Session* session, const struct ClientData* client) {
+  // Socket clients are already connected, both directions go through the same socket
+  if (client->sock_fd != -1) {
+    session->is_socket = 1;
+    session->req_fd = client->sock_fd;
+    session->resp_fd = dup(client->sock_fd);
+    if (session->resp_fd == -1) {
+      perror("Error duplicating session socket");
+      return 1;
     }
 
-    pthread_cond_signal(&buffer_not_full); //signal that the buffer is not full
-    buffer.size--;
+    // Read with MSG_DONTWAIT, O_NONBLOCK would also apply to the responses sent through the duplicate
+    return 0;
+  }
 
-    pthread_mutex_unlock(&buffer_mutex);
+  //Open client pipes
 
-    //Open client pipes
+  // Non blocking from the start: the open does not wait for the client, and the reactor must never block on a session
+  // that has sent half a request. The client has its end open before the response pipe is, so no early end of file
+  session->req_fd = open(client->req_pipe_path, O_RDONLY | O_NONBLOCK);
+  if (session->req_fd == -1){
 
-    int req_pipe_fd = open(current_client->client.req_pipe_path, O_RDONLY);
-    if (req_pipe_fd == -1){
+    perror("erro ao abrir o pipe de requests");
+    return 1;
+  }
+  session->resp_fd = open_response_pipe(client->resp_pipe_path);
+  if (session->resp_fd == -1){
 
-      perror("erro ao abrir o pipe de requests");
-      return NULL;
+    perror("erro ao abrir o pipe de respostas");
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Opens the sessions waiting in the connection buffer and hands them to the workers.
+/// @note A client is only taken from the buffer once a session slot is free, a full server leaves it waiting there.
+void *connector_thread(void *arg) {
+  (void)arg;
+  block_sigusr1();
+
+  while (1) {
+
+    struct Session* session = session_acquire();
+    if (session == NULL) {
+      fprintf(stderr, "Error allocating session buffer\n");
+      sleep(1);
+      continue;
     }
-    int resp_pipe_fd = open(current_client->client.resp_pipe_path, O_WRONLY);
-    if (resp_pipe_fd == -1){
 
-      perror("erro ao abrir o pipe de requests");
-      return NULL;
+    struct ClientData client;
+    ring_pop(&buffer, &client);
+
+    if (open_client(session, &client)) {
+      session_release(session);
+      continue;
+    }
+
+    // Clients asking for shared memory also get whether they got it, and fall back to the pipes otherwise
+    char handshake[sizeof(unsigned int) + sizeof(int)];
+    size_t handshake_size = sizeof(unsigned int);
+    memcpy(handshake, &session->id, sizeof(unsigned int));
+
+    if (client.shm_name[0] != '\0') {
+      session->shm = map_channel(client.shm_name);
+      int shm_status = session->shm == NULL;
+      memcpy(handshake + handshake_size, &shm_status, sizeof(int));
+      handshake_size += sizeof(int);
     }
 
-    if (write(resp_pipe_fd, &session_id, sizeof(unsigned int)) == -1) {
+    if (write(session->resp_fd, handshake, handshake_size) == -1) {
         perror("Error writing session_id to response pipe");
+        session_release(session);
+        continue;
+    }
+
+    // One shot: the reactor rearms a session after each read, unless its backlog is full
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = session};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, session->req_fd, &event) == -1) {
+      perror("Error registering session");
+      session_release(session);
     }
+  }
+}
+
+/// Accepts socket clients and queues them in the connection buffer, like the main thread does for pipe clients.
+/// @param arg Listening socket.
+void *listener_thread(void *arg) {
+  int listen_fd = *(int*)arg;
+  block_sigusr1();
+
+  while (1) {
+    struct ClientData client = {.sock_fd = accept(listen_fd, NULL, NULL)};
+    if (client.sock_fd == -1) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        perror("Error accepting socket client");
+      }
+      continue;
+    }
+
+    // Waits for the connector to take a client if the buffer is full
+    ring_push(&buffer, &client);
+  }
+}
+
+/// Creates the listening socket clients can connect to instead of using the server pipe.
+/// @param path Path to bind the socket to.
+/// @return The socket, -1 on error.
+static int open_listener(const char* path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path too long\n");
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1) {
+    perror("Error creating server socket");
+    return -1;
+  }
+
+  // A socket left behind by a previous server would make bind() fail
+  unlink(path);
+  if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(listen_fd, SOMAXCONN) == -1) {
+    perror("Error binding server socket");
+    close(listen_fd);
+    return -1;
+  }
+
+  return listen_fd;
+}
+
+/// Reads and decodes the requests of every session, the workers only ever see whole requests.
+void *reactor_thread(void *arg) {
+  (void)arg;
+  block_sigusr1();
+
+  struct epoll_event events[REACTOR_BATCH_SIZE];
+
+  while (1) {
+
+    int ready = epoll_wait(epoll_fd, events, REACTOR_BATCH_SIZE, -1);
+
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Error waiting for sessions");
+      return NULL;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      struct Session* session = events[i].data.ptr;
+
+      if (session == NULL) {
+        receive_resumed();
+        continue;
+      }
 
-    int flag = 0;
-
-    //Handle client session
-
-    while(flag == 0){
-
-        char op_code;
-        unsigned int id_dump;
-        ssize_t bytes_read = read(req_pipe_fd, &op_code, sizeof(char));
-
-        if (bytes_read == -1){
-          perror("erros ao ler do pipe da solicitacao");
-          free(current_client);
-          return NULL;
-        }
-        ssize_t id_read = read(req_pipe_fd, &id_dump, sizeof(unsigned int));
-
-        if (id_read == -1){
-          perror("erros ao ler do pipe da solicitacao");
-          free(current_client);
-          return NULL;
-        }
-
-        switch(op_code){
-
-          case '2':
-            close(req_pipe_fd);
-            close(resp_pipe_fd);
-            free(current_client);
-            flag = 1;
-            
-            break;
-
-          case '3':
-            unsigned int event_id_create;
-            size_t num_rows_, num_cols_;
-            
-            ssize_t read_bytes1 = read(req_pipe_fd, &event_id_create, sizeof(unsigned int));
-            if(read_bytes1 == -1){
-              perror("error reading event");
-              break;
-            }
-
-            ssize_t read_bytes2 = read(req_pipe_fd, &num_rows_, sizeof(size_t));
-            if(read_bytes2 == -1){
-              perror("error reading num_rows");
-              break;
-            }
-
-            ssize_t read_bytes3 = read(req_pipe_fd, &num_cols_, sizeof(size_t));
-            if(read_bytes3 == -1){
-              perror("error reading num_columns");
-              break;
-            }
-
-            int result = ems_create(event_id_create, num_rows_, num_cols_);
-
-            if (write(resp_pipe_fd, &result, sizeof(int)) == -1) {
-              perror("Error writing to response pipe");
-              break;
-            }
-            break;
-
-          case '4':
-            unsigned int event_id_reserve;
-            size_t num_seats_;
-
-            ssize_t read_bytes_id = read(req_pipe_fd, &event_id_reserve, sizeof(unsigned int));
-            if(read_bytes_id == -1){
-              perror("error reading id");
-              break;
-            }
-            ssize_t read_bytes_seats = read(req_pipe_fd, &num_seats_, sizeof(size_t));
-            if(read_bytes_seats == -1){
-              perror("error reading seats");
-              break;
-            }
-
-            if (read_bytes_id ==-1 || read_bytes_seats == -1){
-              perror("error reading event or num_Seats");
-              break;
-            }
-
-            size_t xs[MAX_RESERVATION_SIZE];
-            size_t ys[MAX_RESERVATION_SIZE];
-            
-            for (size_t i = 0; i < num_seats_; i++) {
-              ssize_t read_bytes_x = read(req_pipe_fd, &xs[i], sizeof(size_t));
-              if (read_bytes_x == -1){
-                perror("error reading x");
-                break;
-              }
-            }
-
-            for (size_t i = 0; i < num_seats_; i++) {
-              ssize_t read_bytes_y = read(req_pipe_fd, &ys[i], sizeof(size_t));
-              if (read_bytes_y == -1){
-                perror("error reading ");
-                break;
-              }
-            }
-
-            int reserve_result = ems_reserve(event_id_reserve, num_seats_, xs, ys);
-
-            if (write(resp_pipe_fd, &reserve_result, sizeof(int)) == -1) {
-              perror("Error writing to response pipe");
-              break;
-            }
-
-            break;
-
-          case '5':
-
-            unsigned int event_id_show;
-            read(req_pipe_fd, &event_id_show, sizeof(unsigned int));
-
-            if (ems_show(resp_pipe_fd, event_id_show) == 1) {
-              if (write(resp_pipe_fd, &(int){1}, sizeof(int)) == -1) {
-                perror("Error writing to response pipe");
-                break;
-              }
-              
-            }
-            
-            break;
-          
-          case '6':
-
-            if (ems_list_events(resp_pipe_fd) == 1) {
-              if (write(resp_pipe_fd, &(int){1}, sizeof(int)) == -1) {
-                perror("Error writing to response pipe");
-                break;
-              }
-            }
-
-            break;
-        }
+      if (!session->closing) {
+        receive_requests(session);
       }
     }
+  }
+}
+
+/// Serves one request at a time of whichever session has been ready the longest, any worker can serve any session
+/// but a session is only served by one worker at a time, so its requests are answered in order.
+void *worker_thread(void *arg) {
+  (void)arg;
+  block_sigusr1();
+
+  while (1) {
+
+    struct Request* request;
+    struct Session* session = session_next(&request);
+
+    int ended = execute_request(session, request);
+    pool_free(request);
+
+    if (ended) {
+      forget_resumed(session);
+      session_release(session);
+      continue;
+    }
+
+    if (session_yield(session)) {
+      resume_session(session);
+    }
+  }
 }
 
 void sig_handler(int sign){
@@ -243,14 +687,14 @@ void sig_handler(int sign){
 
 int main(int argc, char* argv[]) {
 
-  if (argc < 2 || argc > 3) {
-    fprintf(stderr, "Usage: %s\n <pipe_path> [delay]\n", argv[0]);
+  if (argc < 2 || argc > 6) {
+    fprintf(stderr, "Usage: %s\n <pipe_path> [delay] [workers] [max_sessions] [buffer_size]\n", argv[0]);
     return 1;
   }
 
   char* endptr;
   unsigned int state_access_delay_us = STATE_ACCESS_DELAY_US;
-  if (argc == 3) {
+  if (argc >= 3) {
     unsigned long int delay = strtoul(argv[2], &endptr, 10);
 
     if (*endptr != '\0' || delay > UINT_MAX) {
@@ -261,11 +705,58 @@ int main(int argc, char* argv[]) {
     state_access_delay_us = (unsigned int)delay;
   }
 
+  unsigned long int num_workers = WORKER_THREAD_COUNT;
+  if (argc >= 4) {
+    num_workers = strtoul(argv[3], &endptr, 10);
+
+    if (*endptr != '\0' || num_workers == 0 || num_workers > UINT_MAX) {
+      fprintf(stderr, "Invalid number of workers\n");
+      return 1;
+    }
+  }
+
+  unsigned long int max_sessions = MAX_SESSION_COUNT;
+  if (argc >= 5) {
+    max_sessions = strtoul(argv[4], &endptr, 10);
+
+    if (*endptr != '\0' || max_sessions == 0 || max_sessions > UINT_MAX) {
+      fprintf(stderr, "Invalid number of sessions\n");
+      return 1;
+    }
+  }
+
+  unsigned long int buffer_size = MAX_BUFFER_SIZE;
+  if (argc == 6) {
+    buffer_size = strtoul(argv[5], &endptr, 10);
+
+    if (*endptr != '\0' || buffer_size == 0 || buffer_size > UINT_MAX) {
+      fprintf(stderr, "Invalid buffer size\n");
+      return 1;
+    }
+  }
+
   if (ems_init(state_access_delay_us)) {
     fprintf(stderr, "Failed to initialize EMS\n");
     return 1;
   }
-  
+
+  if (sessions_init(max_sessions)) {
+    fprintf(stderr, "Failed to initialize sessions\n");
+    ems_terminate();
+    return 1;
+  }
+
+  // Reservations reach the sessions subscribed to their event
+  ems_set_listener(session_publish);
+  ems_set_lender(lend_seat_buffer);
+
+  if (ring_init(&buffer, buffer_size, sizeof(struct ClientData))) {
+    fprintf(stderr, "Failed to initialize the connection buffer\n");
+    sessions_terminate();
+    ems_terminate();
+    return 1;
+  }
+
   if (mkfifo(argv[1], 0666) == -1){
     if (errno != EEXIST){
       perror("erro ao criar um server path");
@@ -276,7 +767,7 @@ int main(int argc, char* argv[]) {
 
   //Open server
   int server_pipe_fd = open(argv[1], O_RDWR);
-  
+
   if (server_pipe_fd == -1){
 
     perror("erro ao abrir o servidor");
@@ -284,16 +775,47 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  // Socket clients connect next to the server pipe
+  char socket_path[PATH_MAX];
+  snprintf(socket_path, sizeof(socket_path), "%s.sock", argv[1]);
+  int listen_fd = open_listener(socket_path);
+  if (listen_fd == -1) {
+    ems_terminate();
+    return 1;
+  }
+
+  // Clients that are gone show up as EPIPE on the next write instead of killing the server
+  signal(SIGPIPE, SIG_IGN);
+
+  epoll_fd = epoll_create1(0);
+  if (epoll_fd == -1) {
+    perror("erro ao criar o epoll");
+    ems_terminate();
+    return 1;
+  }
+
+  // Not one shot, workers may resume sessions at any time
+  wake_fd = eventfd(0, EFD_NONBLOCK);
+  struct epoll_event wake_event = {.events = EPOLLIN, .data.ptr = NULL};
+  if (wake_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_event) == -1) {
+    perror("erro ao criar o eventfd do reactor");
+    ems_terminate();
+    return 1;
+  }
+
   //Worker threads array
-  pthread_t workers[MAX_SESSION_COUNT - 1];
+  pthread_t connector, reactor, listener;
+  pthread_t workers[num_workers];
 
-  buffer.head = buffer.tail = NULL;
-  buffer.size = 0;
+  if (pthread_create(&connector, NULL, connector_thread, NULL) != 0 ||
+      pthread_create(&reactor, NULL, reactor_thread, NULL) != 0 ||
+      pthread_create(&listener, NULL, listener_thread, &listen_fd) != 0) {
+    perror("error creating thread");
+    return 1;
+  }
 
-  for (unsigned int i = 0; i < MAX_SESSION_COUNT; i++) {
-    unsigned int *session_id = malloc(sizeof(int));
-    *session_id = i;
-    if(pthread_create(&workers[i], NULL, worker_thread, session_id) < 0){
+  for (unsigned long int i = 0; i < num_workers; i++) {
+    if(pthread_create(&workers[i], NULL, worker_thread, NULL) != 0){
       perror("error creating thread");
       return 1;
     };
@@ -308,20 +830,16 @@ int main(int argc, char* argv[]) {
     // Wait for client to request a session
 
     if(sig == 1){
+      sig = 0;
       ems_handle_sigusr1();
-    }
-
-    char op_code_dump;
-    char req_pipe_path[PIPE_PATH_MAX];
-    char resp_pipe_path[PIPE_PATH_MAX];
-
-    pthread_mutex_lock(&buffer_mutex);
 
-    while (buffer.size == MAX_BUFFER_SIZE) {
-      pthread_cond_wait(&buffer_not_full, &buffer_mutex);
+      size_t hits, misses;
+      pool_stats(&hits, &misses);
+      printf("Buffer pools: %zu hits, %zu misses\n", hits, misses);
     }
 
-    pthread_mutex_unlock(&buffer_mutex);
+    char op_code_dump;
+    struct ClientData client;
 
     ssize_t bytes_read_op = read(server_pipe_fd, &op_code_dump, sizeof(op_code_dump));
     if (bytes_read_op == -1) {
@@ -332,41 +850,32 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    ssize_t bytes_read_req = read(server_pipe_fd, req_pipe_path, sizeof(req_pipe_path));
+    ssize_t bytes_read_req = read(server_pipe_fd, client.req_pipe_path, sizeof(client.req_pipe_path));
     if (bytes_read_req == -1) {
         perror("Error reading request pipe path from server pipe");
         return 1;
     }
 
-    ssize_t bytes_read_resp = read(server_pipe_fd, resp_pipe_path, sizeof(resp_pipe_path));
+    ssize_t bytes_read_resp = read(server_pipe_fd, client.resp_pipe_path, sizeof(client.resp_pipe_path));
     if (bytes_read_resp == -1) {
         perror("Error reading response pipe path from server pipe");
         return 1;
     }
 
-    struct ClientNode* new_client = (struct ClientNode*)malloc(sizeof(struct ClientNode));
-    strncpy(new_client->client.req_pipe_path, req_pipe_path, PIPE_PATH_MAX);
-    strncpy(new_client->client.resp_pipe_path, resp_pipe_path, PIPE_PATH_MAX);
-    new_client->next = NULL;
-
-    pthread_mutex_lock(&buffer_mutex);
-
-    if (buffer.tail == NULL) {
-        buffer.head = new_client;
-        buffer.tail = new_client;
-    } else {
-        buffer.tail->next = new_client;
-        buffer.tail = new_client;
+    client.sock_fd = -1;
+    client.shm_name[0] = '\0';
+    if (op_code_dump == '8' &&
+        read(server_pipe_fd, client.shm_name, sizeof(client.shm_name)) != sizeof(client.shm_name)) {
+        perror("Error reading shared memory name from server pipe");
+        return 1;
     }
-    buffer.size++;
 
-    pthread_cond_signal(&buffer_not_empty); //signal that the buffer is not empty
-
-    pthread_mutex_unlock(&buffer_mutex);
+    // Waits for the connector to take a client if the buffer is full
+    ring_push(&buffer, &client);
   }
 
-  for (int i = 0; i < MAX_SESSION_COUNT; i++) {
-    if(pthread_join(workers[i], NULL)<0){
+  for (unsigned long int i = 0; i < num_workers; i++) {
+    if(pthread_join(workers[i], NULL) != 0){
       perror("error joining thread");
       return 1;
     };
@@ -375,10 +884,15 @@ int main(int argc, char* argv[]) {
   //TODO: Close Server
 
   close(server_pipe_fd);
+  close(listen_fd);
+  close(epoll_fd);
   unlink(argv[1]);
+  unlink(socket_path);
 
+  ring_destroy(&buffer);
+  sessions_terminate();
   ems_terminate();
 
   return 0;
 
-}
\ No newline at end of file
+}
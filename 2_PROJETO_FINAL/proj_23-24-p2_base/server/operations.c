@@ -1,26 +1,35 @@
+#include <sched.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "../common/constants.h"
 #include "../common/io.h"
+#include "../common/pool.h"
+#include "../common/wire.h"
 #include "eventlist.h"
+#include "operations.h"
 
 static struct EventList* event_list = NULL;
 static unsigned int state_access_delay_us = 0;
+static ems_listener reservation_listener = NULL;
+static ems_lender seat_lender = NULL;
+
+// Longest SHOW response header: status, rows, columns, version and kind
+#define SHOW_HEADER_MAX_SIZE (sizeof(int) + 2 * sizeof(size_t) + sizeof(unsigned long) + 1)
 
 /// Gets the event with the given ID from the state.
 /// @note Will wait to simulate a real system accessing a costly memory resource.
 /// @param event_id The ID of the event to get.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode* from, struct ListNode* to) {
+static struct Event* get_event_with_delay(unsigned int event_id) {
   struct timespec delay = {0, state_access_delay_us * 1000};
   nanosleep(&delay, NULL);  // Should not be removed
 
-  return get_event(event_list, event_id, from, to);
+  return get_event(event_list, event_id);
 }
 
 /// Gets the index of a seat.
@@ -31,6 +40,97 @@ static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode
 /// @return Index of the seat.
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
+/// Gets the row lock protecting a row.
+/// @param event Event the row belongs to.
+/// @param row Row, starting at 1.
+/// @return Index of the lock in event->row_locks.
+static size_t row_stripe(struct Event* event, size_t row) { return (row - 1) % event->num_stripes; }
+
+/// Allocates and initializes the row locks of a new event.
+/// @param event Event whose rows are already set.
+/// @return 0 on success, 1 otherwise. Nothing is left allocated on failure.
+static int init_row_locks(struct Event* event) {
+  event->num_stripes = event->rows < EVENT_ROW_STRIPES ? event->rows : EVENT_ROW_STRIPES;
+  if (event->num_stripes == 0) {
+    event->num_stripes = 1;
+  }
+
+  event->row_locks = malloc(event->num_stripes * sizeof(pthread_mutex_t));
+  if (event->row_locks == NULL) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < event->num_stripes; i++) {
+    if (pthread_mutex_init(&event->row_locks[i], NULL) != 0) {
+      while (i-- > 0) {
+        pthread_mutex_destroy(&event->row_locks[i]);
+      }
+      free(event->row_locks);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/// Copies the seats of an event, relaxed loads so reservations may write them meanwhile.
+static void copy_seats(struct Event* event, unsigned int* seats) {
+  size_t num_seats = event->rows * event->cols;
+  for (size_t i = 0; i < num_seats; i++) {
+    seats[i] = atomic_load_explicit(&event->data[i], memory_order_relaxed);
+  }
+}
+
+/// Copies the seats of an event, without taking any lock unless reservations keep it from getting a consistent copy.
+/// @note Retries while a reservation is writing, up to SNAPSHOT_ATTEMPTS times. Reservations on other rows may keep
+/// every attempt from succeeding, so the last copy is taken with every row locked.
+/// @param event Event to copy the seats from.
+/// @param seats Buffer of rows * cols seats to copy the seats to.
+/// @return Version of the event the copy corresponds to.
+static unsigned long snapshot_seats(struct Event* event, void* seats) {
+  for (size_t attempt = 0; attempt < SNAPSHOT_ATTEMPTS; attempt++) {
+    unsigned long version = atomic_load_explicit(&event->version, memory_order_acquire);
+    unsigned long started = atomic_load_explicit(&event->write_seq, memory_order_acquire);
+
+    if (started == version) {
+      copy_seats(event, seats);
+      atomic_thread_fence(memory_order_acquire);
+
+      if (atomic_load_explicit(&event->write_seq, memory_order_relaxed) == started) {
+        return version;
+      }
+    }
+
+    sched_yield();
+  }
+
+  // Every write holds the locks of the rows it books, so none is in progress and the version is the one copied
+  for (size_t i = 0; i < event->num_stripes; i++) {
+    pthread_mutex_lock(&event->row_locks[i]);
+  }
+  unsigned long version = atomic_load_explicit(&event->version, memory_order_acquire);
+  copy_seats(event, seats);
+  for (size_t i = event->num_stripes; i-- > 0;) {
+    pthread_mutex_unlock(&event->row_locks[i]);
+  }
+
+  return version;
+}
+
+/// Unlocks the first num_locked row locks of a sorted stripe list, in reverse order.
+static void unlock_rows(struct Event* event, size_t num_locked, size_t* stripes) {
+  while (num_locked-- > 0) {
+    pthread_mutex_unlock(&event->row_locks[stripes[num_locked]]);
+  }
+}
+
+static int compare_stripes(const void* a, const void* b) {
+  size_t stripe_a = *(const size_t*)a;
+  size_t stripe_b = *(const size_t*)b;
+
+  return (stripe_a > stripe_b) - (stripe_a < stripe_b);
+}
+
 int ems_handle_sigusr1(){
 
   if (event_list == NULL) {
@@ -44,25 +144,49 @@ int ems_handle_sigusr1(){
   }
 
   struct ListNode* current = event_list->head;
+  size_t num_events = 0;
 
-  if (current == NULL) {
+  while (current != NULL) {
+    num_events++;
+    current = current->next;
+  }
+
+  if (num_events == 0) {
     fprintf(stderr, "No events\n");
     pthread_rwlock_unlock(&event_list->rwl);
     return 1;
   }
 
+  struct Event** events = malloc(num_events * sizeof(struct Event*));
+  if (events == NULL) {
+    fprintf(stderr, "Error allocating memory for events\n");
+    pthread_rwlock_unlock(&event_list->rwl);
+    return 1;
+  }
+
+  current = event_list->head;
+  for (size_t i = 0; i < num_events; i++) {
+    events[i] = current->event;
+    current = current->next;
+  }
+
+  // Events are never freed while the server runs, so they are printed once the list is unlocked and creates go on
   pthread_rwlock_unlock(&event_list->rwl);
 
-  while(current != NULL){
+  for (size_t e = 0; e < num_events; e++) {
 
-    if (pthread_mutex_lock(&current->event->mutex) != 0) {
-      fprintf(stderr, "Error locking mutex\n");
+    struct Event* event = events[e];
+    size_t rows = event->rows;
+    size_t cols = event->cols;
+
+    unsigned int* seats = malloc(rows * cols * sizeof(unsigned int));
+    if (seats == NULL) {
+      fprintf(stderr, "Error allocating memory for seats\n");
+      free(events);
       return 1;
     }
 
-    struct Event* event = current->event;
-    size_t rows = event->rows;
-    size_t cols = event->cols;
+    snapshot_seats(event, seats);
 
     printf("Event: %d\n", event->id);
 
@@ -70,7 +194,7 @@ int ems_handle_sigusr1(){
       for (size_t j = 1; j <= cols; j++) {
 
         char buffer[16];
-        sprintf(buffer, "%u", event->data[seat_index(event, i, j)]);
+        sprintf(buffer, "%u", seats[seat_index(event, i, j)]);
 
         printf("%s", buffer);
 
@@ -81,13 +205,17 @@ int ems_handle_sigusr1(){
       }
       printf("\n");
     }
-    pthread_mutex_unlock(&current->event->mutex);
-    current = current->next;
+    free(seats);
   }
 
+  free(events);
   return 0;
 }
 
+void ems_set_listener(ems_listener listener) { reservation_listener = listener; }
+
+void ems_set_lender(ems_lender lender) { seat_lender = lender; }
+
 int ems_init(unsigned int delay_us) {
   if (event_list != NULL) {
     fprintf(stderr, "EMS state has already been initialized\n");
@@ -106,188 +234,677 @@ int ems_terminate() {
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
-    return 1;
-  }
-
   free_list(event_list);
-  pthread_rwlock_unlock(&event_list->rwl);
+  event_list = NULL;
   return 0;
 }
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
-    return 1;
-  }
-
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
-    return 1;
-  }
-
-  if (get_event_with_delay(event_id, event_list->head, event_list->tail) != NULL) {
-    fprintf(stderr, "Event already exists\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    return 1;
-  }
-
+/// Builds an event and publishes it in the list.
+/// @note The caller already checked, with the access delay, that the id was free.
+/// @return The new event, NULL if it could not be created or the id was taken meanwhile.
+static struct Event* create_event(unsigned int event_id, size_t num_rows, size_t num_cols) {
   struct Event* event = malloc(sizeof(struct Event));
 
   if (event == NULL) {
     fprintf(stderr, "Error allocating memory for event\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    return 1;
+    return NULL;
   }
 
   event->id = event_id;
   event->rows = num_rows;
   event->cols = num_cols;
-  event->reservations = 0;
-  if (pthread_mutex_init(&event->mutex, NULL) != 0) {
-    pthread_rwlock_unlock(&event_list->rwl);
+  atomic_init(&event->reservations, 0);
+  atomic_init(&event->write_seq, 0);
+  atomic_init(&event->version, 0);
+  event->num_changes = 0;
+  event->log_floor = 0;
+  atomic_init(&event->rendered[0], 0);
+  atomic_init(&event->rendered[1], 0);
+  if (pthread_mutex_init(&event->log_lock, NULL) != 0) {
     free(event);
-    return 1;
+    return NULL;
   }
-  event->data = calloc(num_rows * num_cols, sizeof(unsigned int));
+  if (init_row_locks(event) != 0) {
+    pthread_mutex_destroy(&event->log_lock);
+    free(event);
+    return NULL;
+  }
+  event->data = calloc(num_rows * num_cols, sizeof(atomic_uint));
+  event->changes = malloc(EVENT_CHANGE_LOG_SIZE * sizeof(struct SeatRange));
 
-  if (event->data == NULL) {
+  if (event->data == NULL || event->changes == NULL) {
     fprintf(stderr, "Error allocating memory for event data\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event);
-    return 1;
+    free_event(event);
+    return NULL;
   }
 
-  if (append_to_list(event_list, event) != 0) {
-    fprintf(stderr, "Error appending event to list\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event->data);
-    free(event);
+  // The event is fully built before it is published, a concurrent create with the same id either sees it or loses
+  struct Event* stored = insert_if_absent(event_list, event);
+
+  if (stored != event) {
+    if (stored == NULL) {
+      fprintf(stderr, "Error appending event to list\n");
+    } else {
+      fprintf(stderr, "Event already exists\n");
+    }
+    free_event(event);
+    return NULL;
+  }
+
+  return event;
+}
+
+/// Checks that a reservation has a valid number of seats, all of them inside the event.
+/// @return 0 if the reservation is valid, 1 otherwise.
+static int validate_seats(struct Event* event, size_t num_seats, size_t* xs, size_t* ys) {
+  if (num_seats == 0 || num_seats > MAX_RESERVATION_SIZE) {
+    fprintf(stderr, "Invalid number of seats\n");
     return 1;
   }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  for (size_t i = 0; i < num_seats; i++) {
+    if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 || ys[i] > event->cols) {
+      fprintf(stderr, "Seat out of bounds\n");
+      return 1;
+    }
+  }
+
   return 0;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+/// Appends the seats of a reservation to the change log, as ranges of consecutive seats.
+/// @param event Event the seats were booked in.
+/// @param write Write that booked them, as returned by begin_write().
+static void log_changes(struct Event* event, unsigned long write, size_t num_seats, size_t* xs, size_t* ys) {
+  pthread_mutex_lock(&event->log_lock);
+
+  size_t i = 0;
+  while (i < num_seats) {
+    size_t first = seat_index(event, xs[i], ys[i]);
+    size_t count = 1;
+    while (i + count < num_seats && seat_index(event, xs[i + count], ys[i + count]) == first + count) {
+      count++;
+    }
+
+    // Overwriting a range means versions up to its write can no longer be brought up to date
+    struct SeatRange* slot = &event->changes[event->num_changes % EVENT_CHANGE_LOG_SIZE];
+    if (event->num_changes >= EVENT_CHANGE_LOG_SIZE && slot->write > event->log_floor) {
+      event->log_floor = slot->write;
+    }
+    *slot = (struct SeatRange){write, first, count};
+    event->num_changes++;
+    i += count;
+  }
+
+  pthread_mutex_unlock(&event->log_lock);
+}
+
+/// Books free seats under a new reservation id.
+/// @note The caller holds the row locks of the seats and has started a write, see snapshot_seats().
+/// @param write Write in progress, logged with the seats.
+/// @param reservation_id Set to the id the seats were booked under.
+/// @return 0 if the seats were booked, 1 if any of them was already reserved.
+static int book_seats(struct Event* event, unsigned long write, size_t num_seats, size_t* xs, size_t* ys,
+                      unsigned int* reservation_id) {
+  for (size_t i = 0; i < num_seats; i++) {
+    if (atomic_load_explicit(&event->data[seat_index(event, xs[i], ys[i])], memory_order_relaxed) != 0) {
+      fprintf(stderr, "Seat already reserved\n");
+      return 1;
+    }
+  }
+
+  *reservation_id = atomic_fetch_add(&event->reservations, 1) + 1;
+
+  for (size_t i = 0; i < num_seats; i++) {
+    atomic_store_explicit(&event->data[seat_index(event, xs[i], ys[i])], *reservation_id, memory_order_relaxed);
+  }
+
+  // Logged before the write ends, so a SHOW that sees the new version also finds the seats in the log
+  log_changes(event, write, num_seats, xs, ys);
+  return 0;
+}
+
+/// Tells optimistic readers a write is in progress before any seat is touched, see snapshot_seats().
+/// @return Number of the write, greater than the version of any snapshot taken before it.
+static unsigned long begin_write(struct Event* event) {
+  unsigned long write = atomic_fetch_add_explicit(&event->write_seq, 1, memory_order_relaxed) + 1;
+  atomic_thread_fence(memory_order_release);
+  return write;
+}
+
+static void end_write(struct Event* event) { atomic_fetch_add_explicit(&event->version, 1, memory_order_release); }
+
+int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  if (get_event_with_delay(event_id) != NULL) {
+    fprintf(stderr, "Event already exists\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
+  return create_event(event_id, num_rows, num_cols) == NULL;
+}
 
-  pthread_rwlock_unlock(&event_list->rwl);
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct Event* event = get_event_with_delay(event_id);
 
   if (event == NULL) {
     fprintf(stderr, "Event not found\n");
     return 1;
   }
 
-  if (pthread_mutex_lock(&event->mutex) != 0) {
-    fprintf(stderr, "Error locking mutex\n");
+  if (validate_seats(event, num_seats, xs, ys)) {
     return 1;
   }
 
+  size_t stripes[MAX_RESERVATION_SIZE];
+
   for (size_t i = 0; i < num_seats; i++) {
-    if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 || ys[i] > event->cols) {
-      fprintf(stderr, "Seat out of bounds\n");
-      pthread_mutex_unlock(&event->mutex);
+    stripes[i] = row_stripe(event, xs[i]);
+  }
+
+  // Only the rows being booked are locked, always in ascending order so overlapping reservations cannot deadlock
+  qsort(stripes, num_seats, sizeof(size_t), compare_stripes);
+
+  size_t num_locked = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    if (num_locked > 0 && stripes[num_locked - 1] == stripes[i]) {
+      continue;
+    }
+
+    stripes[num_locked++] = stripes[i];
+  }
+
+  for (size_t i = 0; i < num_locked; i++) {
+    if (pthread_mutex_lock(&event->row_locks[stripes[i]]) != 0) {
+      fprintf(stderr, "Error locking mutex\n");
+      unlock_rows(event, i, stripes);
       return 1;
     }
   }
 
-  for (size_t i = 0; i < event->rows * event->cols; i++) {
-    for (size_t j = 0; j < num_seats; j++) {
-      if (seat_index(event, xs[j], ys[j]) != i) {
+  unsigned long write = begin_write(event);
+  unsigned int reservation_id;
+  int result = book_seats(event, write, num_seats, xs, ys, &reservation_id);
+  end_write(event);
+
+  unlock_rows(event, num_locked, stripes);
+
+  if (result == 0 && reservation_listener != NULL) {
+    reservation_listener(event_id, reservation_id, num_seats, xs, ys);
+  }
+  return result;
+}
+
+/// Orders batch reservations by event, keeping the batch order within each event.
+static int compare_batch_ops(const void* a, const void* b) {
+  const struct BatchOp* op_a = *(const struct BatchOp* const*)a;
+  const struct BatchOp* op_b = *(const struct BatchOp* const*)b;
+
+  if (op_a->event_id != op_b->event_id) return (op_a->event_id > op_b->event_id) - (op_a->event_id < op_b->event_id);
+  return (op_a > op_b) - (op_a < op_b);
+}
+
+/// Runs consecutive reservations of a batch on one event. The rows they book are locked once for a group of them,
+/// and a group stops growing once its rows span BATCH_RUN_STRIPES row locks.
+/// @param event Event the reservations belong to.
+/// @param ops First reservation.
+/// @param num_ops Number of reservations.
+/// @param ops_base First operation of the batch, to find the status of each operation.
+/// @param statuses Status of each operation of the batch.
+static void reserve_run(struct Event* event, struct BatchOp** ops, size_t num_ops, struct BatchOp* ops_base,
+                        char* statuses) {
+  size_t first = 0;
+  while (first < num_ops) {
+    bool needed[EVENT_ROW_STRIPES] = {false};
+    size_t num_needed = 0;
+
+    size_t last = first;
+    for (; last < num_ops; last++) {
+      struct BatchOp* op = ops[last];
+      if (validate_seats(event, op->num_seats, op->xs, op->ys)) {
+        statuses[op - ops_base] = 1;
         continue;
       }
 
-      if (event->data[i] != 0) {
-        fprintf(stderr, "Seat already reserved\n");
-        pthread_mutex_unlock(&event->mutex);
-        return 1;
+      // Seats in the same row count once per seat, so the bound is conservative
+      size_t num_new = 0;
+      for (size_t i = 0; i < op->num_seats; i++) {
+        num_new += !needed[row_stripe(event, op->xs[i])];
+      }
+      if (num_needed > 0 && num_needed + num_new > BATCH_RUN_STRIPES) {
+        break;
       }
 
-      break;
+      for (size_t i = 0; i < op->num_seats; i++) {
+        size_t stripe = row_stripe(event, op->xs[i]);
+        num_needed += !needed[stripe];
+        needed[stripe] = true;
+      }
+      statuses[op - ops_base] = 0;
     }
-  }
 
-  unsigned int reservation_id = ++event->reservations;
+    // Only the rows the group books are locked, in ascending order like a single reservation
+    size_t stripes[EVENT_ROW_STRIPES];
+    size_t num_locked = 0;
+    for (size_t i = 0; i < event->num_stripes; i++) {
+      if (needed[i]) {
+        stripes[num_locked++] = i;
+      }
+    }
 
-  for (size_t i = 0; i < num_seats; i++) {
-    event->data[seat_index(event, xs[i], ys[i])] = reservation_id;
-  }
+    for (size_t i = 0; i < num_locked; i++) {
+      pthread_mutex_lock(&event->row_locks[stripes[i]]);
+    }
+    unsigned long write = begin_write(event);
 
-  pthread_mutex_unlock(&event->mutex);
-  return 0;
+    for (size_t i = first; i < last; i++) {
+      struct BatchOp* op = ops[i];
+      if (statuses[op - ops_base] == 0) {
+        statuses[op - ops_base] =
+            (char)book_seats(event, write, op->num_seats, op->xs, op->ys, &op->reservation_id);
+      }
+    }
+
+    end_write(event);
+    unlock_rows(event, num_locked, stripes);
+
+    for (size_t i = first; i < last && reservation_listener != NULL; i++) {
+      struct BatchOp* op = ops[i];
+      if (statuses[op - ops_base] == 0) {
+        reservation_listener(event->id, op->reservation_id, op->num_seats, op->xs, op->ys);
+      }
+    }
+
+    first = last;
+  }
 }
 
-int ems_show(int out_fd, unsigned int event_id) {
+int ems_batch(size_t num_ops, struct BatchOp* ops, char* statuses) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  struct BatchOp** order = pool_alloc(num_ops * sizeof(struct BatchOp*));
+  if (order == NULL && num_ops > 0) {
+    fprintf(stderr, "Error allocating memory for batch\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
+  for (size_t i = 0; i < num_ops; i++) {
+    order[i] = &ops[i];
+  }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  size_t i = 0;
+  while (i < num_ops) {
+    // CREATEs run one at a time in batch order, so events enter the list in the order they were sent
+    if (ops[i].op_code == '3') {
+      statuses[i] = (char)ems_create(ops[i].event_id, ops[i].num_rows, ops[i].num_cols);
+      i++;
+      continue;
+    }
+
+    // Reservations up to the next CREATE commute across events, so each event is looked up once and its
+    // reservations run together
+    size_t end = i;
+    while (end < num_ops && ops[end].op_code != '3') {
+      end++;
+    }
+    qsort(order + i, end - i, sizeof(struct BatchOp*), compare_batch_ops);
+
+    while (i < end) {
+      unsigned int event_id = order[i]->event_id;
+      size_t run = 1;
+      while (i + run < end && order[i + run]->event_id == event_id) {
+        run++;
+      }
+
+      struct Event* event = get_event_with_delay(event_id);
+      if (event == NULL) {
+        fprintf(stderr, "Event not found\n");
+        for (size_t j = 0; j < run; j++) {
+          statuses[order[i + j] - ops] = 1;
+        }
+      } else {
+        reserve_run(event, order + i, run, ops, statuses);
+      }
+      i += run;
+    }
+  }
+
+  pool_free(order);
+  return 0;
+}
+
+/// Orders ranges of the change log by their first seat.
+static int compare_ranges(const void* a, const void* b) {
+  size_t first_a = ((const struct SeatRange*)a)->first;
+  size_t first_b = ((const struct SeatRange*)b)->first;
+
+  return (first_a > first_b) - (first_a < first_b);
+}
+
+/// Finds the seats of an event booked after a version the client has.
+/// @param known_version Version the client has, SHOW_UNKNOWN_VERSION if it has none.
+/// @param version Version of the seats being sent.
+/// @param ranges Set to a newly allocated array with the ranges booked after known_version, sorted by first seat.
+/// @param num_ranges Set to the number of ranges.
+/// @return SHOW_UNCHANGED, SHOW_CHANGES, or SHOW_FULL if the log no longer goes back to known_version.
+static char changes_since(struct Event* event, unsigned long known_version, unsigned long version,
+                          struct SeatRange** ranges, size_t* num_ranges) {
+  *ranges = NULL;
+  *num_ranges = 0;
+
+  if (known_version == version) return SHOW_UNCHANGED;
+  if (known_version > version) return SHOW_FULL;
+
+  pthread_mutex_lock(&event->log_lock);
+
+  size_t logged = event->num_changes < EVENT_CHANGE_LOG_SIZE ? event->num_changes : EVENT_CHANGE_LOG_SIZE;
+  struct SeatRange* found = pool_alloc(logged * sizeof(struct SeatRange));
+
+  // A full grid is always a valid answer
+  if (known_version < event->log_floor || (found == NULL && logged > 0)) {
+    pthread_mutex_unlock(&event->log_lock);
+    pool_free(found);
+    return SHOW_FULL;
+  }
+
+  for (size_t i = 0; i < logged; i++) {
+    if (event->changes[i].write > known_version) {
+      found[(*num_ranges)++] = event->changes[i];
+    }
+  }
+
+  pthread_mutex_unlock(&event->log_lock);
+
+  qsort(found, *num_ranges, sizeof(struct SeatRange), compare_ranges);
+  *ranges = found;
+  return SHOW_CHANGES;
+}
+
+/// Allocates a rendered SHOW payload with a single reference, held by the caller.
+/// @param size Number of bytes of data.
+/// @return The payload, NULL on failure.
+static struct ShowBlob* new_rendered(size_t size) {
+  struct ShowBlob* blob = pool_alloc(sizeof(struct ShowBlob) + size);
+  if (blob == NULL) return NULL;
+
+  atomic_init(&blob->refs, 1);
+  blob->size = size;
+  return blob;
+}
+
+/// Drops a reference to a rendered SHOW payload, freeing it with the last one.
+static void release_rendered(struct ShowBlob* blob) {
+  if (blob != NULL && atomic_fetch_sub_explicit(&blob->refs, 1, memory_order_acq_rel) == 1) {
+    pool_free(blob);
+  }
+}
+
+/// Takes a reference to the rendered SHOW payload of an event, whatever its version.
+/// @note Lock free. The pointer is first borrowed by counting the caller in its low bits, which keeps the payload alive
+/// until the reference is taken. Borrows of a payload replaced meanwhile were turned into references by the publisher.
+/// @param runs 1 for the grid as runs, 0 for the seats themselves.
+/// @return The payload, NULL if there is none.
+static struct ShowBlob* take_rendered(struct Event* event, int runs) {
+  atomic_uintptr_t* slot = &event->rendered[runs];
+
+  uintptr_t word = atomic_load_explicit(slot, memory_order_acquire);
+  while (1) {
+    if ((word & ~RENDERED_BORROWS) == 0) return NULL;
+
+    // Every borrow is in use, their holders give them back within a few instructions
+    if ((word & RENDERED_BORROWS) == RENDERED_BORROWS) {
+      sched_yield();
+      word = atomic_load_explicit(slot, memory_order_acquire);
+      continue;
+    }
+
+    if (atomic_compare_exchange_weak_explicit(slot, &word, word + 1, memory_order_acquire, memory_order_acquire)) {
+      break;
+    }
+  }
+
+  struct ShowBlob* blob = (struct ShowBlob*)(word & ~RENDERED_BORROWS);
+  atomic_fetch_add_explicit(&blob->refs, 1, memory_order_relaxed);
+
+  // The borrow goes back to the pointer, or is dropped from the references if the payload was replaced
+  uintptr_t current = word + 1;
+  while (!atomic_compare_exchange_weak_explicit(slot, &current, current - 1, memory_order_release,
+                                                memory_order_relaxed)) {
+    if ((current & ~RENDERED_BORROWS) != (uintptr_t)blob) {
+      release_rendered(blob);
+      break;
+    }
+  }
+
+  return blob;
+}
+
+/// Takes a reference to the rendered SHOW payload of an event if the seats have not changed since it was built.
+/// @param runs 1 for the grid as runs, 0 for the seats themselves.
+/// @return The payload, NULL if there is none for the current version or a reservation is writing.
+static struct ShowBlob* acquire_rendered(struct Event* event, int runs) {
+  unsigned long version = atomic_load_explicit(&event->version, memory_order_acquire);
+  if (atomic_load_explicit(&event->write_seq, memory_order_acquire) != version) return NULL;
+
+  struct ShowBlob* blob = take_rendered(event, runs);
+  if (blob != NULL && blob->version != version) {
+    release_rendered(blob);
+    return NULL;
+  }
+  return blob;
+}
+
+/// Makes a payload the rendered one of an event, unless the one there is as recent. The event takes its own reference.
+/// @param blob Payload whose version is set, not modified afterwards.
+static void publish_rendered(struct Event* event, int runs, struct ShowBlob* blob) {
+  atomic_uintptr_t* slot = &event->rendered[runs];
+  atomic_fetch_add_explicit(&blob->refs, 1, memory_order_relaxed);
+
+  while (1) {
+    // Held so its version can be read, and replaced only if it is still the one in the event
+    struct ShowBlob* old = take_rendered(event, runs);
+    if (old != NULL && old->version >= blob->version) {
+      release_rendered(old);
+      release_rendered(blob);
+      return;
+    }
+
+    uintptr_t word = atomic_load_explicit(slot, memory_order_relaxed);
+    while ((word & ~RENDERED_BORROWS) == (uintptr_t)old) {
+      if (!atomic_compare_exchange_weak_explicit(slot, &word, (uintptr_t)blob, memory_order_acq_rel,
+                                                 memory_order_relaxed)) {
+        continue;
+      }
+
+      // Borrows not given back yet become references, each borrower drops one on seeing the pointer changed
+      if (old != NULL) {
+        atomic_fetch_add_explicit(&old->refs, (unsigned int)(word & RENDERED_BORROWS), memory_order_relaxed);
+        release_rendered(old);
+        release_rendered(old);
+      }
+      return;
+    }
+
+    release_rendered(old);
+  }
+}
+
+/// Writes the header of a SHOW response: status, rows and columns, then with deltas the version sent and its kind.
+/// @param header Buffer with room for SHOW_HEADER_MAX_SIZE bytes.
+/// @return Number of bytes written.
+static size_t put_show_header(char* header, struct Event* event, unsigned int encoding, unsigned long version,
+                              char kind) {
+  int success_status = 0;
+  memcpy(header, &success_status, sizeof(int));
+  memcpy(header + sizeof(int), &event->rows, sizeof(size_t));
+  memcpy(header + sizeof(int) + sizeof(size_t), &event->cols, sizeof(size_t));
+  size_t size = sizeof(int) + 2 * sizeof(size_t);
+
+  if (encoding & ENCODING_SHOW_DELTA) {
+    memcpy(header + size, &version, sizeof(unsigned long));
+    header[size + sizeof(unsigned long)] = kind;
+    size += sizeof(unsigned long) + 1;
+  }
+  return size;
+}
+
+/// Sends a SHOW response with a single call to the sender.
+/// @param bounds Number of ranges and their first seat and count, NULL unless only changes are sent.
+/// @param runs Whether the seats are runs, preceded by their size even when there are none.
+/// @param seats Seats or runs to send after the header and bounds.
+/// @param seats_size Number of bytes of seats.
+/// @return 0 if the response was sent, 1 otherwise.
+static int send_show(ems_sender sender, void* destination, const char* header, size_t header_size,
+                     const size_t* bounds, int runs, const void* seats, size_t seats_size) {
+  struct iovec iov[4];
+  int iovcnt = 0;
+  iov[iovcnt++] = (struct iovec){(void*)header, header_size};
+  if (bounds != NULL) {
+    iov[iovcnt++] = (struct iovec){(void*)bounds, (1 + 2 * bounds[0]) * sizeof(size_t)};
+  }
+  if (runs) {
+    iov[iovcnt++] = (struct iovec){&seats_size, sizeof(size_t)};
+  }
+  if (seats_size > 0) {
+    iov[iovcnt++] = (struct iovec){(void*)seats, seats_size};
+  }
+
+  // Send everything together, no lock is held so a slow client only delays itself
+  if (sender(destination, iov, iovcnt)) {
+    fprintf(stderr, "Error sending show response\n");
+    return 1;
+  }
+  return 0;
+}
+
+int ems_show(ems_sender sender, void* destination, unsigned int event_id, unsigned int encoding,
+             unsigned long known_version) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct Event* event = get_event_with_delay(event_id);
 
   if (event == NULL) {
     fprintf(stderr, "Event not found\n");
     return 1;
   }
 
-  if (pthread_mutex_lock(&event->mutex) != 0) {
-    fprintf(stderr, "Error locking mutex\n");
+  int runs = (encoding & ENCODING_SHOW_RUNS) != 0;
+  char header[SHOW_HEADER_MAX_SIZE];
+
+  // An unchanged event is answered with the grid rendered for its version, unless the client only needs changes
+  struct ShowBlob* blob = acquire_rendered(event, runs);
+  if (blob != NULL && (!(encoding & ENCODING_SHOW_DELTA) || known_version >= blob->version)) {
+    char kind = known_version == blob->version && (encoding & ENCODING_SHOW_DELTA) ? SHOW_UNCHANGED : SHOW_FULL;
+    size_t header_size = put_show_header(header, event, encoding, blob->version, kind);
+    int result = kind == SHOW_FULL
+                     ? send_show(sender, destination, header, header_size, NULL, runs, blob->data, blob->size)
+                     : send_show(sender, destination, header, header_size, NULL, 0, NULL, 0);
+    release_rendered(blob);
+    return result;
+  }
+  release_rendered(blob);
+
+  size_t num_seats = event->rows * event->cols;
+  size_t seats_size = num_seats * sizeof(unsigned int);
+
+  // A lent buffer is reused and sent without another copy, otherwise the seats are copied straight into a payload
+  // that later SHOWs of the same version can be answered with
+  unsigned int* lent = seat_lender != NULL ? seat_lender(destination, seats_size) : NULL;
+  struct ShowBlob* fresh = lent == NULL ? new_rendered(seats_size) : NULL;
+  if (lent == NULL && fresh == NULL) {
+    fprintf(stderr, "Error allocating memory for response buffer\n");
     return 1;
   }
+  unsigned int* seats = lent != NULL ? lent : (unsigned int*)fresh->data;
+
+  // Copy the seats optimistically so reservations are never held up by a SHOW
+  unsigned long version = snapshot_seats(event, seats);
 
-  size_t response_size = sizeof(int) + 2 * sizeof(size_t) + event->rows * event->cols * sizeof(unsigned int);
+  // With deltas the header also carries the version sent and what follows it
+  char kind = SHOW_FULL;
+  struct SeatRange* ranges = NULL;
+  size_t num_ranges = 0;
+  if (encoding & ENCODING_SHOW_DELTA) {
+    kind = changes_since(event, known_version, version, &ranges, &num_ranges);
+  }
+  size_t header_size = put_show_header(header, event, encoding, version, kind);
 
-  // Allocate dynamic memory for the response buffer
-  char* resp_buffer = malloc(response_size);
-  if (resp_buffer == NULL) {
+  // Changes go as the number of ranges, the first seat and count of each, then the seats of every range in order.
+  // Ranges are sorted and never overlap, so their seats can be packed at the front of the copy
+  size_t num_sent = kind == SHOW_FULL ? num_seats : 0;
+  size_t* bounds = NULL;
+  if (kind == SHOW_CHANGES) {
+    bounds = pool_alloc((1 + 2 * num_ranges) * sizeof(size_t));
+    if (bounds == NULL) {
       fprintf(stderr, "Error allocating memory for response buffer\n");
-      pthread_mutex_unlock(&event->mutex);
+      pool_free(ranges);
+      release_rendered(fresh);
       return 1;
+    }
+
+    bounds[0] = num_ranges;
+    for (size_t i = 0; i < num_ranges; i++) {
+      bounds[1 + 2 * i] = ranges[i].first;
+      bounds[2 + 2 * i] = ranges[i].count;
+      memmove(seats + num_sent, seats + ranges[i].first, ranges[i].count * sizeof(unsigned int));
+      num_sent += ranges[i].count;
+    }
+    pool_free(ranges);
   }
 
-  // Construct the response buffer
-  int success_status = 0;
-  memcpy(resp_buffer, &success_status, sizeof(int));
-  memcpy(resp_buffer + sizeof(int), &event->rows, sizeof(size_t));
-  memcpy(resp_buffer + sizeof(int) + sizeof(size_t), &event->cols, sizeof(size_t));
-  memcpy(resp_buffer + sizeof(int) + 2 * sizeof(size_t), event->data, event->rows * event->cols * sizeof(unsigned int));
-
-  // Write the response buffer to the specified pipe
-  if (write(out_fd, resp_buffer, response_size) == -1) {
-      perror("Error writing to response pipe");
-      free(resp_buffer);  // Free the allocated memory
-      pthread_mutex_unlock(&event->mutex);
-      return 1;
+  // Runs of free or equally reserved seats replace the seats
+  blob = NULL;
+  if (runs && kind != SHOW_UNCHANGED) {
+    blob = new_rendered(wire_put_seat_runs(NULL, seats, num_sent));
+    if (blob != NULL) wire_put_seat_runs(blob->data, seats, num_sent);
+  } else if (kind == SHOW_FULL && fresh != NULL) {
+    blob = fresh;
+    fresh = NULL;
   }
 
-  // Free the allocated memory
-  free(resp_buffer);
+  // Seats in a lent buffer are not kept, that would take a second copy of the grid the buffer avoids
+  if (blob == NULL && runs && kind != SHOW_UNCHANGED) {
+    fprintf(stderr, "Error allocating memory for response buffer\n");
+    pool_free(bounds);
+    release_rendered(fresh);
+    return 1;
+  }
 
-  pthread_mutex_unlock(&event->mutex);
-  return 0;
+  // A whole grid is kept for the next SHOWs of its version
+  if (kind == SHOW_FULL && blob != NULL) {
+    blob->version = version;
+    publish_rendered(event, runs, blob);
+  }
+
+  int result;
+  if (blob != NULL) {
+    result = send_show(sender, destination, header, header_size, bounds, runs, blob->data, blob->size);
+  } else {
+    result = send_show(sender, destination, header, header_size, bounds, 0, seats, num_sent * sizeof(unsigned int));
+  }
+
+  pool_free(bounds);
+  release_rendered(blob);
+  release_rendered(fresh);
+  return result;
 }
 
-int ems_list_events(int out_fd) {
+int ems_list_events(ems_sender sender, void* destination) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
@@ -306,35 +923,35 @@ int ems_list_events(int out_fd) {
     current = current->next;
   }
 
-  size_t response_size = sizeof(int) + sizeof(size_t) + num_events * sizeof(unsigned int);
-  char resp_buffer[response_size];
-
-  // Construct the response buffer
+  // Construct the response header
+  char header[sizeof(int) + sizeof(size_t)];
   int success_status = 0;
-  memcpy(resp_buffer, &success_status, sizeof(int));
-  memcpy(resp_buffer + sizeof(int), &num_events, sizeof(size_t));
-
-  if (num_events > 0) {
-    // Copy event IDs into the response buffer
-    struct ListNode* current_ = event_list->head;
-    unsigned int event_ids[num_events];
-    current_ = event_list->head;
-
-    for (size_t i = 0; i < num_events; i++) {
-      event_ids[i] = current_->event->id;
-      current_ = current_->next;
-    }
+  memcpy(header, &success_status, sizeof(int));
+  memcpy(header + sizeof(int), &num_events, sizeof(size_t));
 
-    memcpy(resp_buffer + sizeof(int) + sizeof(size_t), event_ids, num_events * sizeof(unsigned int));
-  }
-
-  // Write the response buffer to the specified pipe
-  if (write(out_fd, resp_buffer, response_size) == -1) {
-    perror("Error writing to response pipe");
+  // Copy event IDs, the buffer is never NULL on success even without events
+  unsigned int* event_ids = pool_alloc(num_events * sizeof(unsigned int));
+  if (event_ids == NULL) {
+    fprintf(stderr, "Error allocating memory for event ids\n");
     pthread_rwlock_unlock(&event_list->rwl);
     return 1;
   }
+  current = event_list->head;
+
+  for (size_t i = 0; i < num_events; i++) {
+    event_ids[i] = current->event->id;
+    current = current->next;
+  }
 
   pthread_rwlock_unlock(&event_list->rwl);
-  return 0;
+
+  // Sent once the list is unlocked, a slow client must not hold up creates
+  struct iovec iov[] = {{header, sizeof(header)}, {event_ids, num_events * sizeof(unsigned int)}};
+  int result = sender(destination, iov, 2);
+  if (result) {
+    fprintf(stderr, "Error sending list response\n");
+  }
+
+  pool_free(event_ids);
+  return result ? 1 : 0;
 }
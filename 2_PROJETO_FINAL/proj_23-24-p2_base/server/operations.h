@@ -2,6 +2,19 @@
 #define SERVER_OPERATIONS_H
 
 #include <stddef.h>
+#include <sys/uio.h>
+
+// CREATE or RESERVE carried by a batch request
+struct BatchOp {
+  char op_code;  // '3' CREATE, '4' RESERVE
+  unsigned int event_id;
+  size_t num_rows;   // CREATE
+  size_t num_cols;   // CREATE
+  size_t num_seats;  // RESERVE
+  size_t *xs;        // RESERVE
+  size_t *ys;        // RESERVE
+  unsigned int reservation_id;  // RESERVE, set once its seats are booked
+};
 
 /// Initializes the EMS state.
 /// @param delay_us Delay in microseconds.
@@ -29,15 +42,59 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 /// @return 0 if the reservation was created successfully, 1 otherwise.
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
 
+/// Told about a reservation once it is committed and its rows are unlocked, from the thread that made it.
+/// @param event_id Event the seats were booked in.
+/// @param reservation_id Id the seats were booked under.
+/// @param num_seats Number of seats booked.
+/// @param xs Rows of the seats.
+/// @param ys Columns of the seats.
+typedef void (*ems_listener)(unsigned int event_id, unsigned int reservation_id, size_t num_seats, const size_t *xs,
+                             const size_t *ys);
+
+/// Sets the function told about every reservation, must be called before any operation runs.
+/// @param listener Function to call, NULL for none.
+void ems_set_listener(ems_listener listener);
+
+/// Lends the buffer a SHOW copies the seats to, so the sender can hand them over without copying them again.
+/// @param destination Where the response goes, as given to the operation.
+/// @param size Bytes needed.
+/// @return Buffer to use until the response is sent, NULL if the operation should allocate its own.
+typedef void *(*ems_lender)(void *destination, size_t size);
+
+/// Sets the function that lends seat buffers to SHOW, must be called before any operation runs.
+/// @param lender Function to call, NULL to always allocate.
+void ems_set_lender(ems_lender lender);
+
+/// Sends the bytes of a response to a client, gathered from several buffers.
+/// @param destination Where to send them, as given to the operation.
+/// @param iov Buffers to send, in order.
+/// @param iovcnt Number of buffers.
+/// @return 0 if every byte was sent, 1 otherwise.
+typedef int (*ems_sender)(void *destination, const struct iovec *iov, int iovcnt);
+
+/// Runs a batch of operations, grouping the reservations between two CREATEs by event so each event is looked up and
+/// locked once for them.
+/// @note The result is the same as running the operations one by one, in order. CREATEs run in batch order.
+/// @param num_ops Number of operations.
+/// @param ops Operations, in the order they were sent.
+/// @param statuses Set to 0 for each operation that succeeded, 1 otherwise.
+/// @return 0 if the batch was run, 1 otherwise.
+int ems_batch(size_t num_ops, struct BatchOp *ops, char *statuses);
+
 /// Prints the given event.
-/// @param out_fd File descriptor to print the event to.
+/// @param sender Function that sends the response.
+/// @param destination Passed to the sender.
 /// @param event_id Id of the event to print.
+/// @param encoding Encoding flags of the session, with ENCODING_SHOW_RUNS the seats are sent as runs.
+/// @param known_version With ENCODING_SHOW_DELTA, version of the event the client has or SHOW_UNKNOWN_VERSION.
 /// @return 0 if the event was printed successfully, 1 otherwise.
-int ems_show(int out_fd, unsigned int event_id);
+int ems_show(ems_sender sender, void *destination, unsigned int event_id, unsigned int encoding,
+             unsigned long known_version);
 
 /// Prints all the events.
-/// @param out_fd File descriptor to print the events to.
+/// @param sender Function that sends the response.
+/// @param destination Passed to the sender.
 /// @return 0 if the events were printed successfully, 1 otherwise.
-int ems_list_events(int out_fd);
+int ems_list_events(ems_sender sender, void *destination);
 
 #endif  // SERVER_OPERATIONS_H
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE  // syscall()
+
+#include "ring.h"
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static void futex_wait(atomic_uint* word, unsigned int expected) {
+  // Returns straight away if the word already moved on, a spurious return only costs another check of the ring
+  syscall(SYS_futex, (unsigned int*)word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word) { syscall(SYS_futex, (unsigned int*)word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0); }
+
+static atomic_size_t* slot_sequence(struct Ring* ring, size_t position) {
+  return (atomic_size_t*)(void*)(ring->slots + (position & ring->mask) * ring->slot_size);
+}
+
+static char* slot_item(struct Ring* ring, size_t position) {
+  return ring->slots + (position & ring->mask) * ring->slot_size + sizeof(atomic_size_t);
+}
+
+int ring_init(struct Ring* ring, size_t capacity, size_t item_size) {
+  if (capacity == 0 || item_size == 0) return 1;
+
+  // A single slot would look free to the next lap as soon as it is filled
+  size_t rounded = 2;
+  while (rounded < capacity) {
+    rounded <<= 1;
+  }
+
+  ring->mask = rounded - 1;
+  ring->item_size = item_size;
+  ring->slot_size = (sizeof(atomic_size_t) + item_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  ring->slots = aligned_alloc(CACHE_LINE_SIZE, rounded * ring->slot_size);
+  if (ring->slots == NULL) return 1;
+
+  for (size_t i = 0; i < rounded; i++) {
+    atomic_init(slot_sequence(ring, i), i);
+  }
+
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->pushes, 0);
+  atomic_init(&ring->pops, 0);
+  atomic_init(&ring->waiting_consumers, 0);
+  atomic_init(&ring->waiting_producers, 0);
+
+  return 0;
+}
+
+void ring_destroy(struct Ring* ring) {
+  free(ring->slots);
+  ring->slots = NULL;
+}
+
+int ring_try_push(struct Ring* ring, const void* item) {
+  size_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+  while (1) {
+    size_t sequence = atomic_load_explicit(slot_sequence(ring, position), memory_order_acquire);
+    intptr_t lap = (intptr_t)sequence - (intptr_t)position;
+
+    if (lap == 0) {
+      // Slot is free for this lap, claim it
+      if (atomic_compare_exchange_weak_explicit(&ring->tail, &position, position + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (lap < 0) {
+      // Slot still holds the item pushed one lap ago
+      return 1;
+    } else {
+      position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+  }
+
+  memcpy(slot_item(ring, position), item, ring->item_size);
+  atomic_store_explicit(slot_sequence(ring, position), position + 1, memory_order_release);
+
+  atomic_fetch_add(&ring->pushes, 1);
+  if (atomic_load(&ring->waiting_consumers) > 0) {
+    futex_wake(&ring->pushes);
+  }
+
+  return 0;
+}
+
+int ring_try_pop(struct Ring* ring, void* item) {
+  size_t position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  while (1) {
+    size_t sequence = atomic_load_explicit(slot_sequence(ring, position), memory_order_acquire);
+    intptr_t lap = (intptr_t)sequence - (intptr_t)(position + 1);
+
+    if (lap == 0) {
+      // Slot was filled for this lap, claim it
+      if (atomic_compare_exchange_weak_explicit(&ring->head, &position, position + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (lap < 0) {
+      // Nothing pushed to this slot yet
+      return 1;
+    } else {
+      position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    }
+  }
+
+  memcpy(item, slot_item(ring, position), ring->item_size);
+  atomic_store_explicit(slot_sequence(ring, position), position + ring->mask + 1, memory_order_release);
+
+  atomic_fetch_add(&ring->pops, 1);
+  if (atomic_load(&ring->waiting_producers) > 0) {
+    futex_wake(&ring->pops);
+  }
+
+  return 0;
+}
+
+#define RING_SPIN_COUNT 64  // Retries before a thread parks on the futex
+
+// Waiters announce themselves before sampling the futex word and checking the ring again, while the other side
+// bumps the word before checking for waiters: either the waiter sees the new item or the waker sees the waiter.
+
+void ring_push(struct Ring* ring, const void* item) {
+  for (int i = 0; i < RING_SPIN_COUNT; i++) {
+    if (ring_try_push(ring, item) == 0) return;
+    sched_yield();
+  }
+
+  while (ring_try_push(ring, item) != 0) {
+    atomic_fetch_add(&ring->waiting_producers, 1);
+    unsigned int pops = atomic_load(&ring->pops);
+
+    if (ring_try_push(ring, item) == 0) {
+      atomic_fetch_sub(&ring->waiting_producers, 1);
+      return;
+    }
+
+    futex_wait(&ring->pops, pops);
+    atomic_fetch_sub(&ring->waiting_producers, 1);
+  }
+}
+
+void ring_pop(struct Ring* ring, void* item) {
+  for (int i = 0; i < RING_SPIN_COUNT; i++) {
+    if (ring_try_pop(ring, item) == 0) return;
+    sched_yield();
+  }
+
+  while (ring_try_pop(ring, item) != 0) {
+    atomic_fetch_add(&ring->waiting_consumers, 1);
+    unsigned int pushes = atomic_load(&ring->pushes);
+
+    if (ring_try_pop(ring, item) == 0) {
+      atomic_fetch_sub(&ring->waiting_consumers, 1);
+      return;
+    }
+
+    futex_wait(&ring->pushes, pushes);
+    atomic_fetch_sub(&ring->waiting_consumers, 1);
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef SERVER_RING_H
+#define SERVER_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Bounded lock-free multi-producer multi-consumer queue of fixed-size items.
+// Every slot carries a sequence number telling whether it is free or full for the current lap, producers and
+// consumers claim slots with a compare-and-swap on tail/head and only sleep (on a futex) when the ring stays
+// full/empty for a short spin.
+struct Ring {
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t head;  // Next slot to pop
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;  // Next slot to push
+
+  _Alignas(CACHE_LINE_SIZE) atomic_uint pushes;  // Futex word, bumped after every push
+  atomic_uint waiting_consumers;
+  _Alignas(CACHE_LINE_SIZE) atomic_uint pops;  // Futex word, bumped after every pop
+  atomic_uint waiting_producers;
+
+  _Alignas(CACHE_LINE_SIZE) size_t mask;  // Capacity - 1, capacity is a power of two
+  size_t item_size;
+  size_t slot_size;  // Sequence number plus item, rounded up to whole cache lines
+  char* slots;
+};
+
+/// Initializes a ring.
+/// @param ring Ring to be initialized.
+/// @param capacity Minimum number of items the ring holds, rounded up to a power of two (at least 2).
+/// @param item_size Size of each item.
+/// @return 0 if the ring was initialized successfully, 1 otherwise.
+int ring_init(struct Ring* ring, size_t capacity, size_t item_size);
+
+/// Frees the slots of a ring.
+/// @param ring Ring to be destroyed, no thread may be using it.
+void ring_destroy(struct Ring* ring);
+
+/// Copies an item into the ring if there is room for it.
+/// @param ring Ring to push to.
+/// @param item Item of ring->item_size bytes.
+/// @return 0 if the item was pushed, 1 if the ring is full.
+int ring_try_push(struct Ring* ring, const void* item);
+
+/// Copies the oldest item out of the ring if there is one.
+/// @param ring Ring to pop from.
+/// @param item Buffer of ring->item_size bytes.
+/// @return 0 if an item was popped, 1 if the ring is empty.
+int ring_try_pop(struct Ring* ring, void* item);
+
+/// Copies an item into the ring, sleeping while it is full.
+/// @param ring Ring to push to.
+/// @param item Item of ring->item_size bytes.
+void ring_push(struct Ring* ring, const void* item);
+
+/// Copies the oldest item out of the ring, sleeping while it is empty.
+/// @param ring Ring to pop from.
+/// @param item Buffer of ring->item_size bytes.
+void ring_pop(struct Ring* ring, void* item);
+
+#endif  // SERVER_RING_H
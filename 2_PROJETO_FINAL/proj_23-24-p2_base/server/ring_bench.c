@@ -0,0 +1,173 @@
+// Connection buffer microbenchmark: the lock-free ring against the mutex/condvar linked list it replaced.
+// Usage: ./ring_bench [producers] [consumers] [capacity] [items]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common/constants.h"
+#include "ring.h"
+
+struct ClientData {
+  char req_pipe_path[PIPE_PATH_MAX];
+  char resp_pipe_path[PIPE_PATH_MAX];
+};
+
+// Old connection buffer, a linked list of malloc'd nodes behind one mutex
+struct ClientNode {
+  struct ClientData client;
+  struct ClientNode* next;
+};
+
+struct ListBuffer {
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  struct ClientNode* head;
+  struct ClientNode* tail;
+  size_t size;
+  size_t capacity;
+};
+
+static void list_push(struct ListBuffer* buffer, const struct ClientData* client) {
+  struct ClientNode* node = malloc(sizeof(struct ClientNode));
+  if (node == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  node->client = *client;
+  node->next = NULL;
+
+  pthread_mutex_lock(&buffer->mutex);
+  while (buffer->size == buffer->capacity) {
+    pthread_cond_wait(&buffer->not_full, &buffer->mutex);
+  }
+  if (buffer->tail == NULL) {
+    buffer->head = node;
+  } else {
+    buffer->tail->next = node;
+  }
+  buffer->tail = node;
+  buffer->size++;
+  pthread_cond_signal(&buffer->not_empty);
+  pthread_mutex_unlock(&buffer->mutex);
+}
+
+static void list_pop(struct ListBuffer* buffer, struct ClientData* client) {
+  pthread_mutex_lock(&buffer->mutex);
+  while (buffer->head == NULL) {
+    pthread_cond_wait(&buffer->not_empty, &buffer->mutex);
+  }
+  struct ClientNode* node = buffer->head;
+  buffer->head = node->next;
+  if (buffer->head == NULL) {
+    buffer->tail = NULL;
+  }
+  buffer->size--;
+  pthread_cond_signal(&buffer->not_full);
+  pthread_mutex_unlock(&buffer->mutex);
+
+  *client = node->client;
+  free(node);
+}
+
+struct BenchArgs {
+  int use_ring;
+  struct Ring* ring;
+  struct ListBuffer* list;
+  size_t items;
+};
+
+static void* producer(void* arg) {
+  struct BenchArgs* args = arg;
+  struct ClientData client;
+  memset(&client, 0, sizeof(client));
+
+  for (size_t i = 0; i < args->items; i++) {
+    snprintf(client.req_pipe_path, PIPE_PATH_MAX, "req%zu", i);
+    if (args->use_ring) {
+      ring_push(args->ring, &client);
+    } else {
+      list_push(args->list, &client);
+    }
+  }
+  return NULL;
+}
+
+static void* consumer(void* arg) {
+  struct BenchArgs* args = arg;
+  struct ClientData client;
+
+  for (size_t i = 0; i < args->items; i++) {
+    if (args->use_ring) {
+      ring_pop(args->ring, &client);
+    } else {
+      list_pop(args->list, &client);
+    }
+  }
+  return NULL;
+}
+
+static double run(int use_ring, size_t producers, size_t consumers, size_t capacity, size_t items) {
+  struct Ring ring;
+  struct ListBuffer list = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                            NULL, NULL, 0, capacity};
+  if (use_ring && ring_init(&ring, capacity, sizeof(struct ClientData))) {
+    fprintf(stderr, "Failed to initialize ring\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Every producer pushes items / producers, every consumer pops items / consumers
+  struct BenchArgs push_args = {use_ring, &ring, &list, items / producers};
+  struct BenchArgs pop_args = {use_ring, &ring, &list, items / consumers};
+  pthread_t threads[producers + consumers];
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t i = 0; i < producers + consumers; i++) {
+    int err = i < producers ? pthread_create(&threads[i], NULL, producer, &push_args)
+                            : pthread_create(&threads[i], NULL, consumer, &pop_args);
+    if (err != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (size_t i = 0; i < producers + consumers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (use_ring) ring_destroy(&ring);
+
+  return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+  size_t producers = argc > 1 ? strtoul(argv[1], NULL, 10) : 1;
+  size_t consumers = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+  size_t capacity = argc > 3 ? strtoul(argv[3], NULL, 10) : MAX_BUFFER_SIZE;
+  size_t items = argc > 4 ? strtoul(argv[4], NULL, 10) : 1000000;
+
+  if (producers == 0 || consumers == 0 || capacity == 0) {
+    fprintf(stderr, "Usage: %s [producers] [consumers] [capacity] [items]\n", argv[0]);
+    return 1;
+  }
+
+  // Both sides must move the same number of items
+  items -= items % (producers * consumers);
+  if (items == 0) items = producers * consumers;
+
+  printf("%zu producers, %zu consumers, capacity %zu, %zu items\n", producers, consumers, capacity, items);
+
+  double list_time = run(0, producers, consumers, capacity, items);
+  printf("mutex list: %.3fs, %.0f items/s\n", list_time, (double)items / list_time);
+
+  double ring_time = run(1, producers, consumers, capacity, items);
+  printf("ring:       %.3fs, %.0f items/s\n", ring_time, (double)items / ring_time);
+
+  return 0;
+}
@@ -0,0 +1,781 @@
+#define _GNU_SOURCE  // vmsplice()
+#include "session.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "../common/pool.h"
+
+static struct Session* sessions = NULL;
+static size_t num_sessions = 0;
+static unsigned int* free_ids = NULL;  // Stack of the ids not in use
+static size_t num_free = 0;
+
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t session_released = PTHREAD_COND_INITIALIZER;
+
+// Sessions with pending requests that no worker is serving, in the order they became ready
+static struct Session* ready_head = NULL;
+static struct Session* ready_tail = NULL;
+static pthread_mutex_t ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t session_ready = PTHREAD_COND_INITIALIZER;
+
+#define SUBSCRIBER_BUCKETS 256  // Buckets of the subscriber index, by event id
+
+// Session subscribed to an event
+struct Subscriber {
+  unsigned int event_id;
+  struct Session* session;
+  size_t index;           // Position of the event in the session's subscriptions
+  unsigned int encoding;  // Encoding flags the notifications are sent in
+  struct Subscriber* next;
+};
+
+// Subscribers of every event, read by each reservation and written when sessions subscribe or are released
+static struct Subscriber* subscribers[SUBSCRIBER_BUCKETS];
+static pthread_rwlock_t subscribers_lock = PTHREAD_RWLOCK_INITIALIZER;
+static atomic_size_t num_subscribers;  // Lets reservations skip the lock while nobody subscribed
+
+// Page aligned buffer a worker copies the seats of a SHOW to, spliced into a response pipe instead of copied
+struct SpliceBuffer {
+  void* data;
+  size_t capacity;
+  struct Session* lent_to;  // Session whose pipe may still reference the pages, NULL if none does
+  unsigned long generation;  // Generation of lent_to when the pages were spliced
+};
+
+static _Thread_local struct SpliceBuffer splice_buffers[SPLICE_BUFFERS];
+static _Thread_local struct SpliceBuffer* splice_buffer = NULL;  // Last one handed out by session_splice_buffer
+
+int sessions_init(size_t max_sessions) {
+  if (sessions != NULL || max_sessions == 0) return 1;
+
+  sessions = malloc(max_sessions * sizeof(struct Session));
+  free_ids = malloc(max_sessions * sizeof(unsigned int));
+  if (sessions == NULL || free_ids == NULL) {
+    free(sessions);
+    free(free_ids);
+    sessions = NULL;
+    free_ids = NULL;
+    return 1;
+  }
+
+  // Lowest ids are handed out first
+  for (size_t i = 0; i < max_sessions; i++) {
+    if (pthread_mutex_init(&sessions[i].mutex, NULL) != 0) {
+      while (i-- > 0) {
+        pthread_mutex_destroy(&sessions[i].mutex);
+      }
+      free(sessions);
+      free(free_ids);
+      sessions = NULL;
+      free_ids = NULL;
+      return 1;
+    }
+
+    sessions[i].id = (unsigned int)i;
+    sessions[i].req_fd = -1;
+    sessions[i].resp_fd = -1;
+    sessions[i].shm = NULL;
+    sessions[i].recv_buffer = NULL;
+    sessions[i].generation = 0;
+    free_ids[i] = (unsigned int)(max_sessions - 1 - i);
+  }
+  num_sessions = max_sessions;
+  num_free = max_sessions;
+
+  return 0;
+}
+
+void sessions_terminate() {
+  for (size_t i = 0; i < num_sessions; i++) {
+    pthread_mutex_destroy(&sessions[i].mutex);
+  }
+  free(sessions);
+  free(free_ids);
+  sessions = NULL;
+  free_ids = NULL;
+  num_sessions = 0;
+  num_free = 0;
+}
+
+struct Session* session_acquire() {
+  if (sessions == NULL) return NULL;
+
+  pthread_mutex_lock(&sessions_mutex);
+
+  while (num_free == 0) {
+    pthread_cond_wait(&session_released, &sessions_mutex);
+  }
+
+  struct Session* session = &sessions[free_ids[--num_free]];
+
+  pthread_mutex_unlock(&sessions_mutex);
+
+  // Idle slots hold no buffer, a table sized for many sessions costs little until they connect
+  session->recv_buffer = pool_alloc(MAX_FRAME_SIZE);
+  if (session->recv_buffer == NULL) {
+    pthread_mutex_lock(&sessions_mutex);
+    free_ids[num_free++] = session->id;
+    pthread_cond_signal(&session_released);
+    pthread_mutex_unlock(&sessions_mutex);
+    return NULL;
+  }
+
+  session->is_socket = 0;
+  session->recv_len = 0;
+  session->closing = 0;
+  session->encoding = ENCODING_FIXED;
+  session->next_resumed = NULL;
+  session->head = NULL;
+  session->tail = NULL;
+  session->num_pending = 0;
+  session->scheduled = 0;
+  session->paused = 0;
+  session->num_notices = 0;
+  session->num_subscriptions = 0;
+  session->next_ready = NULL;
+
+  return session;
+}
+
+/// Drops every subscription of a session, no notification can be queued for it afterwards.
+static void unsubscribe(struct Session* session) {
+  if (session->num_subscriptions == 0) return;
+
+  pthread_rwlock_wrlock(&subscribers_lock);
+  for (size_t i = 0; i < session->num_subscriptions; i++) {
+    struct Subscriber** link = &subscribers[session->subscriptions[i] % SUBSCRIBER_BUCKETS];
+    while (*link != NULL) {
+      struct Subscriber* subscriber = *link;
+      if (subscriber->session == session && subscriber->index == i) {
+        *link = subscriber->next;
+        free(subscriber);
+        atomic_fetch_sub(&num_subscribers, 1);
+        break;
+      }
+      link = &subscriber->next;
+    }
+  }
+  session->num_subscriptions = 0;
+  pthread_rwlock_unlock(&subscribers_lock);
+}
+
+void session_release(struct Session* session) {
+  unsubscribe(session);
+
+  // Closed before the pipes, so the client sees it instead of waiting for its peer check
+  if (session->shm != NULL) {
+    shm_channel_close(session->shm);
+    munmap(session->shm, sizeof(struct ShmChannel));
+    session->shm = NULL;
+  }
+
+  // Closed under the mutex, a worker checking a splice buffer lent to the session never sees the pipe go away
+  pthread_mutex_lock(&session->mutex);
+  if (session->req_fd != -1) close(session->req_fd);
+  if (session->resp_fd != -1) close(session->resp_fd);
+  session->req_fd = -1;
+  session->resp_fd = -1;
+  session->generation++;
+
+  while (session->head != NULL) {
+    struct Request* request = session->head;
+    session->head = request->next;
+    pool_free(request);
+  }
+  session->tail = NULL;
+  session->num_pending = 0;
+  session->num_notices = 0;
+  pthread_mutex_unlock(&session->mutex);
+
+  pool_free(session->recv_buffer);
+  session->recv_buffer = NULL;
+
+  pthread_mutex_lock(&sessions_mutex);
+  free_ids[num_free++] = session->id;
+  pthread_cond_signal(&session_released);
+  pthread_mutex_unlock(&sessions_mutex);
+}
+
+/// Checks whether the pipe a splice buffer was handed to still references its pages.
+/// @note The session it was lent to may be served by another worker, so it is only checked if its mutex is free.
+/// @return 1 if the buffer may be written again, 0 otherwise.
+static int splice_buffer_returned(struct SpliceBuffer* buffer) {
+  if (buffer->lent_to == NULL) return 1;
+
+  struct Session* session = buffer->lent_to;
+  if (pthread_mutex_trylock(&session->mutex) != 0) return 0;
+
+  // Pages a client has read are no longer referenced by the pipe
+  int unread = -1;
+  int released = session->generation != buffer->generation;
+  if (!released) ioctl(session->resp_fd, FIONREAD, &unread);
+  pthread_mutex_unlock(&session->mutex);
+
+  // A closed pipe can still be read by its client, so its pages are left to it, which keeps them after the unmap
+  if (released) {
+    munmap(buffer->data, buffer->capacity);
+    buffer->data = NULL;
+    buffer->capacity = 0;
+  } else if (unread != 0) {
+    return 0;
+  }
+
+  buffer->lent_to = NULL;
+  return 1;
+}
+
+void* session_splice_buffer(struct Session* session, size_t size) {
+  // Only pipes take pages, and small grids are cheaper to copy
+  if (session->shm != NULL || session->is_socket || size < SPLICE_MIN_SIZE) return NULL;
+
+  // A returned buffer that is big enough is preferred, then the largest returned one, which is grown
+  struct SpliceBuffer* buffer = NULL;
+  for (size_t i = 0; i < SPLICE_BUFFERS; i++) {
+    struct SpliceBuffer* candidate = &splice_buffers[i];
+    if (!splice_buffer_returned(candidate)) continue;
+
+    if (buffer == NULL || (buffer->capacity < size && candidate->capacity > buffer->capacity)) buffer = candidate;
+  }
+
+  // Every buffer is still in a pipe, the caller copies instead of new pages being mapped for each response
+  splice_buffer = buffer;
+  if (buffer == NULL) return NULL;
+
+  if (buffer->capacity < size) {
+    if (buffer->data != NULL) {
+      munmap(buffer->data, buffer->capacity);
+      buffer->data = NULL;
+      buffer->capacity = 0;
+    }
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t capacity = (size + page_size - 1) / page_size * page_size;
+    void* data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+      perror("Error mapping splice buffer");
+      splice_buffer = NULL;
+      return NULL;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+
+  return buffer->data;
+}
+
+/// Hands the pages of the splice buffer to a response pipe.
+/// @param session Pipe session to send to.
+/// @param iov Bytes of the splice buffer to send, moved past the ones sent.
+/// @return 0 if every byte was sent, 1 if the pipe refused them and the rest must be written.
+static int splice_all(struct Session* session, struct iovec* iov) {
+  while (iov->iov_len > 0) {
+    ssize_t spliced = vmsplice(session->resp_fd, iov, 1, 0);
+    if (spliced == -1) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+
+    // Only the worker serving the session changes its pipe, so the generation can be read without the mutex
+    splice_buffer->lent_to = session;
+    splice_buffer->generation = session->generation;
+    iov->iov_base = (char*)iov->iov_base + spliced;
+    iov->iov_len -= (size_t)spliced;
+  }
+  return 0;
+}
+
+/// Writes bytes to the response pipe or socket of a session, copying them.
+/// @return 0 if every byte was written, 1 otherwise.
+static int write_all(struct Session* session, const struct iovec* iov, int iovcnt) {
+  // Moved past the bytes already written, a pipe may take only part of them
+  struct iovec remaining[iovcnt];
+  memcpy(remaining, iov, sizeof(remaining));
+  int first = 0;
+
+  while (first < iovcnt) {
+    int count = iovcnt - first;
+    size_t cut = 0;  // Bytes of the last buffer left for the next datagram
+
+    // Datagrams are sent whole or not at all, so at most SOCKET_MESSAGE_SIZE bytes go in each
+    if (session->is_socket) {
+      size_t total = 0;
+      for (count = 0; first + count < iovcnt && total < SOCKET_MESSAGE_SIZE; count++) {
+        total += remaining[first + count].iov_len;
+      }
+      if (total > SOCKET_MESSAGE_SIZE) {
+        cut = total - SOCKET_MESSAGE_SIZE;
+        remaining[first + count - 1].iov_len -= cut;
+      }
+    }
+
+    ssize_t written = writev(session->resp_fd, remaining + first, count);
+    remaining[first + count - 1].iov_len += cut;
+
+    if (written == -1) {
+      if (errno == EINTR) continue;
+      perror("Error writing to response pipe");
+      return 1;
+    }
+
+    size_t left = (size_t)written;
+    while (first < iovcnt && left >= remaining[first].iov_len) {
+      left -= remaining[first].iov_len;
+      first++;
+    }
+    if (first < iovcnt) {
+      remaining[first].iov_base = (char*)remaining[first].iov_base + left;
+      remaining[first].iov_len -= left;
+    }
+  }
+  return 0;
+}
+
+int session_send(void* destination, const struct iovec* iov, int iovcnt) {
+  struct Session* session = destination;
+
+  if (session->shm != NULL) {
+    for (int i = 0; i < iovcnt; i++) {
+      if (shm_ring_send(&session->shm->responses, iov[i].iov_base, iov[i].iov_len, session->resp_fd, 0)) return 1;
+    }
+    return 0;
+  }
+
+  // Bytes in the splice buffer go by reference, the ones around them are copied
+  for (int i = 0; i < iovcnt && !session->is_socket; i++) {
+    if (splice_buffer == NULL || splice_buffer->data == NULL || iov[i].iov_base != splice_buffer->data) continue;
+
+    struct iovec spliced = iov[i];
+    if ((i > 0 && write_all(session, iov, i)) || (splice_all(session, &spliced) && write_all(session, &spliced, 1))) {
+      return 1;
+    }
+    return i + 1 < iovcnt ? write_all(session, iov + i + 1, iovcnt - i - 1) : 0;
+  }
+
+  return write_all(session, iov, iovcnt);
+}
+
+/// Copies a field out of a request buffer.
+/// @return 0 if the field is complete, 1 if more bytes are needed.
+static int take(const char* buffer, size_t len, size_t* offset, void* field, size_t size) {
+  if (len - *offset < size) return 1;
+
+  memcpy(field, buffer + *offset, size);
+  *offset += size;
+  return 0;
+}
+
+/// Decodes one operation of a batch request.
+/// @param buffer Bytes of the batch operations.
+/// @param len Number of bytes of the batch operations.
+/// @param offset Position of the operation, moved past it.
+/// @param encoding Encoding of the CREATE and RESERVE fields.
+/// @param op Operation to fill in, or NULL to only check it.
+/// @param coords Where the seats of a reservation are copied to, only used if op is set.
+/// @return Number of seats of the operation, or -1 if it is malformed.
+static ssize_t decode_batch_op(const char* buffer, size_t len, size_t* offset, unsigned int encoding,
+                               struct BatchOp* op, size_t* coords) {
+  struct BatchOp decoded = {0};
+
+  if (take(buffer, len, offset, &decoded.op_code, sizeof(char))) return -1;
+
+  switch (decoded.op_code) {
+    case '3':
+      if (wire_get_create(buffer, len, offset, encoding, &decoded.event_id, &decoded.num_rows, &decoded.num_cols)) {
+        return -1;
+      }
+      break;
+
+    case '4':
+      if (wire_get_reserve(buffer, len, offset, encoding, &decoded.event_id, &decoded.num_seats)) return -1;
+      if (decoded.num_seats == 0 || decoded.num_seats > MAX_RESERVATION_SIZE) return -1;
+
+      if (op != NULL) {
+        decoded.xs = coords;
+        decoded.ys = coords + decoded.num_seats;
+      }
+      if (wire_get_seats(buffer, len, offset, encoding, decoded.num_seats, decoded.xs, decoded.ys)) return -1;
+      break;
+
+    default:
+      return -1;
+  }
+
+  if (op != NULL) *op = decoded;
+  return (ssize_t)decoded.num_seats;
+}
+
+ssize_t decode_request(const char* buffer, size_t len, unsigned int encoding, struct Request** request) {
+  size_t offset = 0;
+  unsigned int frame_size;
+  char op_code;
+  unsigned int session_id;
+  unsigned int request_id;
+  unsigned int event_id = 0;
+  unsigned int requested_encoding = encoding;
+  unsigned long known_version = SHOW_UNKNOWN_VERSION;
+  size_t num_rows = 0, num_cols = 0, num_seats = 0;
+  size_t num_ops = 0, ops_size = 0;
+  size_t num_events = 0;
+
+  if (take(buffer, len, &offset, &frame_size, sizeof(unsigned int))) return 0;
+
+  // Bigger frames could never fit in the receive buffer
+  if (frame_size > MAX_FRAME_SIZE - sizeof(unsigned int)) return -1;
+  if (len - offset < frame_size) return 0;
+
+  // The whole frame is here, anything missing from it is malformed
+  len = offset + frame_size;
+  size_t payload_offset = 0;  // Where the seats, batch operations or event ids copied after the fields start
+
+  if (take(buffer, len, &offset, &op_code, sizeof(char)) || take(buffer, len, &offset, &session_id, sizeof(unsigned int)) ||
+      take(buffer, len, &offset, &request_id, sizeof(unsigned int))) {
+    return -1;
+  }
+
+  switch (op_code) {
+    case '2':
+    case '6':
+      break;
+
+    case '3':
+      if (wire_get_create(buffer, len, &offset, encoding, &event_id, &num_rows, &num_cols)) return -1;
+      break;
+
+    case '4':
+      if (wire_get_reserve(buffer, len, &offset, encoding, &event_id, &num_seats)) return -1;
+      if (num_seats == 0 || num_seats > MAX_RESERVATION_SIZE) return -1;
+
+      // First pass only checks the seats, they are copied once the request is allocated
+      payload_offset = offset;
+      if (wire_get_seats(buffer, len, &offset, encoding, num_seats, NULL, NULL)) return -1;
+      break;
+
+    case '5':
+      if (take(buffer, len, &offset, &event_id, sizeof(unsigned int))) {
+        return -1;
+      }
+      if ((encoding & ENCODING_SHOW_DELTA) && take(buffer, len, &offset, &known_version, sizeof(unsigned long))) {
+        return -1;
+      }
+      break;
+
+    case '7': {
+      if (take(buffer, len, &offset, &num_ops, sizeof(size_t)) || take(buffer, len, &offset, &ops_size, sizeof(size_t))) {
+        return -1;
+      }
+
+      if (num_ops == 0 || ops_size > MAX_BATCH_SIZE || len - offset < ops_size) return -1;
+      payload_offset = offset;
+
+      // First pass only validates and counts the seats, so the request is allocated once
+      size_t ops_offset = 0;
+      for (size_t i = 0; i < num_ops; i++) {
+        ssize_t op_seats = decode_batch_op(buffer + offset, ops_size, &ops_offset, encoding, NULL, NULL);
+        if (op_seats == -1) return -1;
+        num_seats += (size_t)op_seats;
+      }
+      if (ops_offset != ops_size || num_seats > MAX_BATCH_SEATS) return -1;
+      offset += ops_size;
+      break;
+    }
+
+    case '9':
+      if (take(buffer, len, &offset, &requested_encoding, sizeof(unsigned int))) return -1;
+      break;
+
+    case 'A':
+      if (take(buffer, len, &offset, &num_events, sizeof(size_t))) return -1;
+      if (num_events == 0 || num_events > MAX_SUBSCRIPTIONS) return -1;
+      if (len - offset < num_events * sizeof(unsigned int)) return -1;
+      payload_offset = offset;
+      offset += num_events * sizeof(unsigned int);
+      break;
+
+    default:
+      return -1;
+  }
+
+  // The frame must end exactly where the request does
+  if (offset != len) return -1;
+
+  struct Request* decoded =
+      pool_alloc(sizeof(struct Request) + (2 * num_seats + num_events) * sizeof(size_t) + num_ops * sizeof(struct BatchOp));
+  if (decoded == NULL) return -1;
+
+  decoded->op_code = op_code;
+  decoded->request_id = request_id;
+  decoded->event_id = event_id;
+  decoded->encoding = requested_encoding;
+  decoded->known_version = known_version;
+  decoded->reservation_id = 0;
+  decoded->num_events = num_events;
+  decoded->num_rows = num_rows;
+  decoded->num_cols = num_cols;
+  decoded->num_seats = num_seats;
+  decoded->xs = decoded->coords;
+  decoded->ys = decoded->coords + num_seats;
+  decoded->num_ops = num_ops;
+  decoded->ops = NULL;
+  decoded->next = NULL;
+
+  if (op_code == '7') {
+    decoded->ops = (struct BatchOp*)(void*)(decoded->coords + 2 * num_seats);
+
+    size_t* coords = decoded->coords;
+    size_t ops_offset = 0;
+    for (size_t i = 0; i < num_ops; i++) {
+      coords += 2 * (size_t)decode_batch_op(buffer + payload_offset, ops_size, &ops_offset, encoding, &decoded->ops[i],
+                                            coords);
+    }
+  } else if (op_code == 'A') {
+    for (size_t i = 0; i < num_events; i++) {
+      unsigned int id;
+      take(buffer, len, &payload_offset, &id, sizeof(unsigned int));
+      decoded->coords[i] = id;
+    }
+  } else if (num_seats > 0) {
+    wire_get_seats(buffer, len, &payload_offset, encoding, num_seats, decoded->xs, decoded->ys);
+  }
+
+  *request = decoded;
+  return (ssize_t)offset;
+}
+
+static void schedule(struct Session* session) {
+  pthread_mutex_lock(&ready_mutex);
+
+  session->next_ready = NULL;
+  if (ready_tail == NULL) {
+    ready_head = session;
+  } else {
+    ready_tail->next_ready = session;
+  }
+  ready_tail = session;
+
+  pthread_cond_signal(&session_ready);
+  pthread_mutex_unlock(&ready_mutex);
+}
+
+size_t session_push(struct Session* session, struct Request* request) {
+  pthread_mutex_lock(&session->mutex);
+
+  request->next = NULL;
+  if (session->tail == NULL) {
+    session->head = request;
+  } else {
+    session->tail->next = request;
+  }
+  session->tail = request;
+
+  size_t num_pending = ++session->num_pending;
+  if (num_pending >= SESSION_MAX_PENDING) {
+    session->paused = 1;
+  }
+
+  int idle = !session->scheduled;
+  session->scheduled = 1;
+
+  pthread_mutex_unlock(&session->mutex);
+
+  if (idle) {
+    schedule(session);
+  }
+
+  return num_pending;
+}
+
+int session_subscribe(struct Session* session, unsigned int encoding, size_t num_events, const size_t* event_ids) {
+  pthread_rwlock_wrlock(&subscribers_lock);
+  pthread_mutex_lock(&session->mutex);
+
+  // Only new events take a slot, and either all of them fit or none is added
+  size_t num_new = 0;
+  for (size_t i = 0; i < num_events; i++) {
+    int known = 0;
+    for (size_t j = 0; j < session->num_subscriptions && !known; j++) {
+      known = session->subscriptions[j] == event_ids[i];
+    }
+    for (size_t j = 0; j < i && !known; j++) {
+      known = event_ids[j] == event_ids[i];
+    }
+    num_new += !known;
+  }
+
+  int result = session->num_subscriptions + num_new > MAX_SUBSCRIPTIONS;
+  for (size_t i = 0; i < num_events && result == 0; i++) {
+    unsigned int event_id = (unsigned int)event_ids[i];
+    int known = 0;
+    for (size_t j = 0; j < session->num_subscriptions && !known; j++) {
+      known = session->subscriptions[j] == event_id;
+    }
+    if (known) continue;
+
+    struct Subscriber* subscriber = malloc(sizeof(struct Subscriber));
+    if (subscriber == NULL) {
+      fprintf(stderr, "Error allocating memory for subscription\n");
+      result = 1;
+      break;
+    }
+
+    size_t index = session->num_subscriptions++;
+    session->subscriptions[index] = event_id;
+    session->resync_queued[index] = 0;
+    *subscriber = (struct Subscriber){event_id, session, index, encoding, subscribers[event_id % SUBSCRIBER_BUCKETS]};
+    subscribers[event_id % SUBSCRIBER_BUCKETS] = subscriber;
+    atomic_fetch_add(&num_subscribers, 1);
+  }
+
+  pthread_mutex_unlock(&session->mutex);
+  pthread_rwlock_unlock(&subscribers_lock);
+  return result;
+}
+
+/// Queues a notification for one subscriber, coalescing it once the session has too many queued.
+static void notify(struct Subscriber* subscriber, unsigned int reservation_id, size_t num_seats, const size_t* xs,
+                   const size_t* ys) {
+  struct Session* session = subscriber->session;
+
+  // Built before taking the lock, thrown away if the session already knows it missed reservations
+  struct Request* notice = pool_alloc(sizeof(struct Request) + 2 * num_seats * sizeof(size_t));
+  if (notice == NULL) {
+    fprintf(stderr, "Error allocating memory for notification\n");
+    return;
+  }
+  notice->op_code = 'N';
+  notice->request_id = 0;
+  notice->event_id = subscriber->event_id;
+  notice->encoding = subscriber->encoding;
+  notice->reservation_id = reservation_id;
+  notice->num_seats = num_seats;
+  notice->xs = notice->coords;
+  notice->ys = notice->coords + num_seats;
+  memcpy(notice->xs, xs, num_seats * sizeof(size_t));
+  memcpy(notice->ys, ys, num_seats * sizeof(size_t));
+  notice->next = NULL;
+
+  pthread_mutex_lock(&session->mutex);
+
+  if (session->num_notices >= SUBSCRIBER_QUEUE_SIZE) {
+    if (session->resync_queued[subscriber->index]) {
+      pthread_mutex_unlock(&session->mutex);
+      pool_free(notice);
+      return;
+    }
+
+    // Every reservation dropped from now on is covered by this one, which tells the client to show the event again
+    session->resync_queued[subscriber->index] = 1;
+    notice->reservation_id = 0;
+    notice->num_seats = 0;
+  }
+
+  if (session->tail == NULL) {
+    session->head = notice;
+  } else {
+    session->tail->next = notice;
+  }
+  session->tail = notice;
+  session->num_notices++;
+
+  int idle = !session->scheduled;
+  session->scheduled = 1;
+
+  pthread_mutex_unlock(&session->mutex);
+
+  if (idle) {
+    schedule(session);
+  }
+}
+
+void session_publish(unsigned int event_id, unsigned int reservation_id, size_t num_seats, const size_t* xs,
+                     const size_t* ys) {
+  if (atomic_load(&num_subscribers) == 0) return;
+
+  pthread_rwlock_rdlock(&subscribers_lock);
+  for (struct Subscriber* subscriber = subscribers[event_id % SUBSCRIBER_BUCKETS]; subscriber != NULL;
+       subscriber = subscriber->next) {
+    if (subscriber->event_id == event_id) {
+      notify(subscriber, reservation_id, num_seats, xs, ys);
+    }
+  }
+  pthread_rwlock_unlock(&subscribers_lock);
+}
+
+int session_wants_input(struct Session* session) {
+  pthread_mutex_lock(&session->mutex);
+  int wants_input = !session->paused;
+  pthread_mutex_unlock(&session->mutex);
+
+  return wants_input;
+}
+
+struct Session* session_next(struct Request** request) {
+  pthread_mutex_lock(&ready_mutex);
+
+  while (ready_head == NULL) {
+    pthread_cond_wait(&session_ready, &ready_mutex);
+  }
+
+  struct Session* session = ready_head;
+  ready_head = session->next_ready;
+  if (ready_head == NULL) {
+    ready_tail = NULL;
+  }
+
+  pthread_mutex_unlock(&ready_mutex);
+
+  // Only the worker holding a scheduled session pops from it, so the queue cannot be empty here
+  pthread_mutex_lock(&session->mutex);
+  *request = session->head;
+  session->head = (*request)->next;
+  if (session->head == NULL) {
+    session->tail = NULL;
+  }
+
+  if ((*request)->op_code != 'N') {
+    session->num_pending--;
+  } else {
+    session->num_notices--;
+    for (size_t i = 0; i < session->num_subscriptions && (*request)->reservation_id == 0; i++) {
+      if (session->subscriptions[i] == (*request)->event_id) {
+        session->resync_queued[i] = 0;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&session->mutex);
+
+  return session;
+}
+
+int session_yield(struct Session* session) {
+  pthread_mutex_lock(&session->mutex);
+
+  int resume = 0;
+  if (session->paused && session->num_pending <= SESSION_MAX_PENDING / 2) {
+    session->paused = 0;
+    resume = 1;
+  }
+
+  int more = session->head != NULL;
+  session->scheduled = more;
+
+  pthread_mutex_unlock(&session->mutex);
+
+  if (more) {
+    schedule(session);
+  }
+
+  return resume;
+}
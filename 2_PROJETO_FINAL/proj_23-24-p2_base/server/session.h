@@ -0,0 +1,146 @@
+#ifndef SERVER_SESSION_H
+#define SERVER_SESSION_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "../common/constants.h"
+#include "../common/shm_ring.h"
+#include "../common/wire.h"
+#include "operations.h"
+
+// Decoded request, waiting in its session queue
+struct Request {
+  char op_code;
+  unsigned int request_id;  // Chosen by the client, echoed at the start of the response
+  unsigned int event_id;  // CREATE, RESERVE, SHOW and NOTIFY
+  unsigned int encoding;  // ENCODING: the flags asked for, others: the session encoding when decoded
+  unsigned long known_version;  // SHOW with ENCODING_SHOW_DELTA
+  unsigned int reservation_id;  // NOTIFY, 0 when the client missed reservations of the event
+  size_t num_events;            // SUBSCRIBE, the ids are stored in coords
+  size_t num_rows;        // CREATE
+  size_t num_cols;        // CREATE
+  size_t num_seats;       // RESERVE
+  size_t* xs;             // RESERVE and NOTIFY, points into coords
+  size_t* ys;             // RESERVE and NOTIFY, points into coords
+  size_t num_ops;         // BATCH
+  struct BatchOp* ops;    // BATCH, stored after coords
+  struct Request* next;
+  size_t coords[];  // xs followed by ys, for each reservation
+};
+
+struct Session {
+  unsigned int id;  // Session id, also its slot in the session table
+  int req_fd;       // Request pipe, read end. Only carries doorbells when shm is set
+  int resp_fd;      // Response pipe, write end. Only used to notice the client is gone when shm is set
+  struct ShmChannel* shm;  // Shared memory rings negotiated by the client, NULL for pipes only
+  int is_socket;           // req_fd and resp_fd are the same SOCK_SEQPACKET connection
+
+  // Only touched by the reactor thread
+  char* recv_buffer;  // Bytes read but not decoded yet, MAX_FRAME_SIZE of them, only held while the session is open
+  size_t recv_len;
+  int closing;  // No more reads, a close request is queued
+  unsigned int encoding;  // Encoding flags of the requests and SHOW responses, set by an ENCODING request
+  struct Session* next_resumed;  // Next session the reactor must read again, see main.c
+
+  pthread_mutex_t mutex;  // Protects the fields below
+  struct Request* head;   // Requests not served yet, in arrival order
+  struct Request* tail;
+  size_t num_pending;
+  unsigned long generation;  // Times the slot was released, tells a later client apart from an earlier one
+  int scheduled;  // In the run queue or being served by a worker
+  int paused;     // Reading stopped until the backlog drains
+  size_t num_notices;  // NOTIFY requests queued, not counted in num_pending
+  unsigned int subscriptions[MAX_SUBSCRIPTIONS];  // Events whose reservations are pushed to the client
+  char resync_queued[MAX_SUBSCRIPTIONS];  // A notice that reservations of the event were missed is queued
+  size_t num_subscriptions;
+
+  struct Session* next_ready;  // Next session in the run queue
+};
+
+/// Creates the session table.
+/// @param max_sessions Maximum number of sessions open at the same time.
+/// @return 0 if the table was created successfully, 1 otherwise.
+int sessions_init(size_t max_sessions);
+
+/// Destroys the session table.
+void sessions_terminate();
+
+/// Takes a free session slot, waiting for one to be released if all of them are in use.
+/// @return The session, with its pipes unset, an empty queue and a receive buffer. NULL if the table was not
+/// initialized or the receive buffer could not be allocated.
+struct Session* session_acquire();
+
+/// Closes the pipes and shared memory of a session, drops its pending requests and gives its slot back.
+/// @param session Session to be released.
+void session_release(struct Session* session);
+
+/// Sends response bytes to the client of a session with as few writes as possible, through its shared memory ring if
+/// it has one.
+/// @note On a socket the bytes are split in datagrams of at most SOCKET_MESSAGE_SIZE.
+/// @note Matches ems_sender, destination is the session.
+/// @param destination Session to send to.
+/// @param iov Buffers to send, in order.
+/// @param iovcnt Number of buffers.
+/// @return 0 if every byte was sent, 1 otherwise.
+int session_send(void* destination, const struct iovec* iov, int iovcnt);
+
+/// Gets a reusable page aligned buffer of the calling worker, whose bytes session_send() hands to a response pipe
+/// with vmsplice() instead of copying them.
+/// @note Each worker keeps SPLICE_BUFFERS of them, one is only reused once the pipe it was spliced into has nothing
+/// left to read. One spliced into the pipe of a client that is gone is left to the pipe.
+/// @param session Session the response goes to, held by the calling worker.
+/// @param size Bytes needed.
+/// @return The buffer, valid until the next call from the same worker. NULL for shared memory and socket sessions,
+/// for sizes under SPLICE_MIN_SIZE, while every buffer of the worker is still in a pipe, or if it could not be mapped.
+void* session_splice_buffer(struct Session* session, size_t size);
+
+/// Decodes the first request in a buffer.
+/// @note Requests are framed, an unsigned int with the size of the rest of the frame comes first.
+/// @param buffer Bytes received from a client.
+/// @param len Number of bytes in the buffer.
+/// @param encoding Encoding flags of the session, kept in the request so its response uses them too.
+/// @param request Pointer to store the newly allocated request in.
+/// @return Number of bytes consumed, 0 if the request is not complete yet, -1 if it is malformed.
+ssize_t decode_request(const char* buffer, size_t len, unsigned int encoding, struct Request** request);
+
+/// Queues a request at the end of its session, scheduling the session if it was idle.
+/// @param session Session the request belongs to.
+/// @param request Request to be queued.
+/// @return Number of requests pending in the session, including this one.
+size_t session_push(struct Session* session, struct Request* request);
+
+/// Subscribes a session to the reservations of some events, each one is pushed to the client as a NOTIFY request.
+/// @note Events the session already subscribed to are skipped, the events do not have to exist yet.
+/// @param session Session to subscribe, held by the calling worker.
+/// @param encoding Encoding flags the notifications are sent in.
+/// @param num_events Number of events.
+/// @param event_ids Ids of the events.
+/// @return 0 if the session was subscribed to every event, 1 if it would go over MAX_SUBSCRIPTIONS.
+int session_subscribe(struct Session* session, unsigned int encoding, size_t num_events, const size_t* event_ids);
+
+/// Queues a notification of a reservation for every session subscribed to its event.
+/// @note Matches ems_listener. Never waits for a client: once SUBSCRIBER_QUEUE_SIZE notifications are queued for a
+/// session the rest are dropped, leaving a single notification with reservation id 0 per event.
+void session_publish(unsigned int event_id, unsigned int reservation_id, size_t num_seats, const size_t* xs,
+                     const size_t* ys);
+
+/// Checks whether more requests should be read for a session.
+/// @param session Session to check.
+/// @return 0 if the session has too many requests pending, 1 otherwise.
+int session_wants_input(struct Session* session);
+
+/// Waits for a session with pending requests and takes its oldest request.
+/// @note The session is not handed to any other worker until session_yield() is called.
+/// @param request Pointer to store the request in.
+/// @return The session the request belongs to.
+struct Session* session_next(struct Request** request);
+
+/// Gives a session back after serving one of its requests, rescheduling it behind the other ready sessions if it
+/// still has pending requests.
+/// @param session Session returned by session_next().
+/// @return 1 if the session was paused and its backlog drained, so reading should resume, 0 otherwise.
+int session_yield(struct Session* session);
+
+#endif  // SERVER_SESSION_H